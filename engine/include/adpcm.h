@@ -0,0 +1,23 @@
+#pragma once
+#include "common.h"
+
+DISABLE_WARNINGS
+#include <vector>
+ENABLE_WARNINGS
+
+// IMA ADPCM, laid out like WAV format 0x11 (and OpenAL's IMA4). 4 bits a sample, so a bit under 4:1 against
+// 16 bit PCM once the block headers are counted. Blocks start with the exact first sample of each channel,
+// so any block can be decoded on its own
+
+#define ADPCM_BLOCK_BYTES_PER_CHANNEL 512 // 1017 frames a block, ~23ms at 44.1kHz
+
+// Frames in a full block of block_align bytes
+u32 adpcm_frames_per_block(u16 block_align, u16 channel_count);
+
+// Decodes block_count whole blocks into interleaved 16 bit frames. out_frames needs room for
+// block_count * adpcm_frames_per_block
+void adpcm_decode(const u8 *blocks, u32 block_count, u16 block_align, u16 channel_count, i16 *out_frames);
+
+// Interleaved 16 bit frames to blocks of ADPCM_BLOCK_BYTES_PER_CHANNEL * channel_count bytes. The last block
+// is padded with the last frame, the real length has to be kept next to it (the fact chunk in a WAV)
+std::vector<u8> adpcm_encode(const i16 *frames, u32 frame_count, u16 channel_count);
@@ -1,4 +1,5 @@
 #include "common.h"
+#include "sfx.h"
 
 DISABLE_WARNINGS
 #include <memory>
@@ -20,7 +21,7 @@ struct Application {
     std::unique_ptr<struct IGame> game;
 
     PREVENT_COPY_MOVE(Application);
-    Application(std::unique_ptr<IGame> game);
+    Application(std::unique_ptr<IGame> game, const SfxSettings &sfx_settings = SfxSettings());
     ~Application();
 
     void loop();
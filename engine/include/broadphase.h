@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+#include "common.h"
+#include "tomath.h"
+
+#define BROADPHASE_DEFAULT_CELL_SIZE 1.0f
+#define BROADPHASE_DEFAULT_BUCKET_COUNT 4096 // Has to be a power of two
+
+struct BroadphasePair {
+    u32 a;
+    u32 b;
+};
+
+struct BroadphaseProxy {
+    Vec2 min; // World rect as of the last update
+    Vec2 max;
+    i32 cell_min_x; // Cells the rect covers, inclusive
+    i32 cell_min_y;
+    i32 cell_max_x;
+    i32 cell_max_y;
+    const struct GoData *go; // Null for free slots
+    u32 query_stamp;         // So that rect queries report an object once, even if it's in many cells
+};
+
+// Uniform grid over the world rects of GoData, hashed into a fixed number of buckets so the world has no
+// bounds. Cells that collide in the hash share a bucket, everything coming out of a bucket is checked
+// against the actual cell. An object is in every cell its rect touches, so it should be around the cell
+// size or smaller; a huge one just costs more buckets
+class Broadphase {
+    f32 cell_size;
+    f32 inv_cell_size;
+    std::vector<std::vector<u32>> buckets;
+    std::vector<BroadphaseProxy> proxies;
+    std::vector<u32> free_proxies;
+    u32 query_stamp;
+
+    u32 bucket_index(i32 cell_x, i32 cell_y) const;
+    i32 cell_coord(f32 pos) const;
+    void insert_cells(u32 id);
+    void remove_cells(u32 id);
+    bool is_in_cell(const BroadphaseProxy &proxy, i32 cell_x, i32 cell_y) const;
+
+  public:
+    PREVENT_COPY_MOVE(Broadphase);
+    explicit Broadphase(f32 cell_size = BROADPHASE_DEFAULT_CELL_SIZE,
+                        u32 bucket_count = BROADPHASE_DEFAULT_BUCKET_COUNT);
+
+    u32 add(const struct GoData &go);
+    void remove(u32 id);
+    const struct GoData &get_go(u32 id) const;
+
+    // Reads the GoData's world rect again. Only touches the buckets when the rect moved to other cells
+    void update(u32 id);
+    void update_all();
+
+    // Every pair whose rects overlap, each one reported once
+    void query_pairs(std::vector<BroadphasePair> &out_pairs);
+    void query_rect(Vec2 min, Vec2 max, std::vector<u32> &out_ids);
+
+    // First object a point moving by displacement hits, walking the cells along the way. -1 if none
+    i32 raycast(Vec2 from, Vec2 displacement, struct SweepHit &out_hit) const;
+};
@@ -0,0 +1,40 @@
+#pragma once
+#include "common.h"
+#include "tomath.h"
+
+struct SweepHit {
+    f32 toi;     // Time of impact, as a fraction of the displacement in [0, 1]
+    Vec2 normal; // Of the face that was hit, pointing out of the box
+};
+
+// Slab method. Starting inside the box is a hit at toi 0, with the normal of the face it's closest to, when
+// moving in through that face. Moving out or along it is no hit
+bool sweep_point_aabb(Vec2 from, Vec2 displacement, const struct Rect &box, SweepHit &out_hit);
+
+// The box grown by the mover's half size, then the mover's center is swept as a point
+bool sweep_aabb_aabb(const struct Rect &mover, Vec2 displacement, const struct Rect &box, SweepHit &out_hit);
+
+// One point against many boxes kept as separate arrays, 4 boxes at a time. Returns the index of the earliest
+// hit, or -1 if there's none
+i32 sweep_point_aabbs(Vec2 from, Vec2 displacement, const f32 *min_x, const f32 *min_y, const f32 *max_x,
+                      const f32 *max_y, usize count, SweepHit &out_hit);
+
+
+#define COLLISION_MAX_BOUNCES 8 // Per tick. Past this, the mover stays put for the rest of the tick
+
+struct CollisionBounce {
+    u32 box_index;
+    Vec2 position; // Mover's center at the moment of impact
+    Vec2 normal;
+};
+
+// Runs after each reflection and can change the velocity (e.g. speed it up). context is passed through as is
+typedef void (*collision_bounce_func)(const CollisionBounce &bounce, Vec2 &velocity, void *context);
+
+// Continuous collision for one box moving through static boxes. Sweeps to the earliest hit, reflects the
+// velocity off it and sweeps again with the time that's left, until the tick is used up. Nothing tunnels,
+// whatever the speed or dt. Returns the number of bounces written, position and velocity are the ones at
+// the end of the tick
+u32 sweep_and_bounce(Vec2 &position, Vec2 half_size, Vec2 &velocity, f32 dt, const struct Rect *boxes,
+                     usize box_count, CollisionBounce *out_bounces, u32 max_bounces,
+                     collision_bounce_func on_bounce = nullptr, void *context = nullptr);
\ No newline at end of file
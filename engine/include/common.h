@@ -10,6 +10,7 @@ typedef uint16_t u16;
 typedef uint8_t u8;
 typedef int64_t i64;
 typedef int32_t i32;
+typedef int16_t i16;
 typedef size_t usize;
 typedef float f32;
 
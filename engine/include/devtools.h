@@ -0,0 +1,15 @@
+#pragma once
+#include "common.h"
+
+// Command line entries for measuring and checking engine pieces without opening a window. Run as
+// `main --<flag>`, they print what they found and return the process exit code
+
+typedef int (*devtool_func)(int argc, char **argv); // Arguments after the flag
+
+struct DevTool {
+    const char *flag;
+    devtool_func run;
+    const char *description;
+};
+
+const DevTool *devtool_find(const char *flag); // nullptr when it's not one of ours
@@ -4,6 +4,9 @@
 #include <functional>
 #include <optional>
 #include "godata.h"
+#include "collision.h"
+#include "broadphase.h"
+#include "transform.h"
 #include "input.h"
 #include "render.h"
 #include "particle.h"
@@ -19,6 +22,8 @@ struct Entity {
 struct GameObject : public Entity {
     GoData data;
     GoRenderUnit ru;
+    u32 broadphase_id;
+    i32 transform_node; // TRANSFORM_NO_PARENT until it's attached to something or something to it
 
     PREVENT_COPY_MOVE(GameObject);
     explicit GameObject(const std::string &tag, GoData data, GoRenderUnit ru);
@@ -26,10 +31,18 @@ struct GameObject : public Entity {
 
 struct ParticleSystem : public Entity {
     ParticleSource ps;
-    ParticleRenderUnit ru;
+    texture_handle texture; // Owned by the renderer's particle batch
 
     PREVENT_COPY_MOVE(ParticleSystem);
-    explicit ParticleSystem(const std::string &tag, ParticleSource ps, ParticleRenderUnit ru);
+    explicit ParticleSystem(const std::string &tag, ParticleSource ps, texture_handle texture);
+};
+
+struct Emitter : public Entity {
+    ParticleEmitter emitter;
+    texture_handle texture; // Owned by the renderer's particle batch
+
+    PREVENT_COPY_MOVE(Emitter);
+    explicit Emitter(const std::string &tag, ParticleEmitter emitter, texture_handle texture);
 };
 
 struct Widget : public Entity {
@@ -49,6 +62,9 @@ struct Scene {
     std::vector<std::weak_ptr<GameObject>> state_gos;
     std::vector<std::weak_ptr<Widget>> state_ui;
     std::vector<std::weak_ptr<ParticleSystem>> state_particles;
+    std::vector<std::weak_ptr<Emitter>> state_emitters;
+    std::vector<std::weak_ptr<GpuParticleSystem>> state_gpu_particles;
+    std::vector<std::weak_ptr<AnalyticParticleSystem>> state_analytic_particles;
 
     explicit Scene(const std::string &name, std::function<std::optional<std::string>(f32, Engine &)> update);
 };
@@ -58,32 +74,60 @@ class Engine {
 
     std::vector<std::shared_ptr<GameObject>> game_objects;
     std::vector<std::shared_ptr<ParticleSystem>> particles;
+    std::vector<std::shared_ptr<Emitter>> emitters;
+    u32 particle_budget; // Most emitter particles alive at once, over all emitters
     std::vector<std::shared_ptr<Widget>> ui;
     std::vector<Scene> all_scenes;
 
     Input input;
     Sfx sfx;
     std::unordered_map<ParticleSystemType, ParticleProps> particle_props;
+    std::unordered_map<ParticleSystemType, std::shared_ptr<GpuParticleSystem>> gpu_particles;
+    std::unordered_map<ParticleSystemType, std::shared_ptr<AnalyticParticleSystem>> analytic_particles;
+
+    // Everything random in the world comes from here, particle sources get their own seeded from it. Same
+    // seed, same match
+    u64 seed;
+    Rng rng;
 
     Renderer renderer;
     FontData font_data;
+    Broadphase broadphase;
+    TransformHierarchy transforms;
 
   public:
     PREVENT_COPY_MOVE(Engine);
-    explicit Engine(u32 screen_width, u32 screen_height, f32 cam_size, std::vector<SfxAsset> sfx_assets);
+    explicit Engine(u32 screen_width, u32 screen_height, f32 cam_size, std::vector<SfxAsset> sfx_assets,
+                    u64 seed, const SfxSettings &sfx_settings = SfxSettings());
 
     GameObject &get_go(const std::string &tag) const;
     Widget &get_widget(const std::string &tag) const;
     Scene &get_scene(const std::string &name);
     const RenderInfo &get_render_info() const;
+    Broadphase &get_broadphase();
+    TransformHierarchy &get_transforms();
+    Rng &get_rng();
+    u64 get_seed() const;
 
     void register_particle_prop(ParticleSystemType type, const ParticleProps &props);
     void register_particle(const std::string &state_name, ParticleSystemType type, Vec2 emit_point);
     void deregister_particle(usize index);
+    void deregister_particle(const ParticleSystem &ps);
+
+    void register_emitter(const std::string &tag, const std::string &state_name,
+                          const ParticleEmitterProps &props, Vec2 emit_point);
+    Emitter &get_emitter(const std::string &tag) const;
+    void set_particle_budget(u32 budget);
+    void enforce_particle_budget();
 
     void register_gameobject(const std::string &tag, const std::string &state_name, Vec2 pos, Vec2 size,
                              char *texture_path);
 
+    // From then on the child follows the parent. It stays where it is on attach, move it relative to the
+    // parent with get_transforms().set_local(). No reparenting: a child can't be attached again, a parent
+    // can't become a child later
+    void attach_gameobject(const std::string &child_tag, const std::string &parent_tag);
+
     void register_ui_entity(const std::string &tag, const std::string &state_name, const std::string &text,
                             TextTransform transform);
 
@@ -91,6 +135,10 @@ class Engine {
                         std::function<std::optional<std::string>(f32, Engine &)> update);
 
     void sfx_play(SfxId id);
+    void sfx_dump_latency();
+    sfx_stream_handle sfx_stream_open(const std::string &file_name, bool is_looping);
+    void sfx_stream_play(sfx_stream_handle stream);
+    void sfx_stream_stop(sfx_stream_handle stream);
     void particle_play(const std::string &state_name, ParticleSystemType type, Vec2 collision_point);
     bool input_just_pressed(KeyCode key_code) const;
     bool input_is_down(KeyCode key_code) const;
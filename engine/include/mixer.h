@@ -0,0 +1,87 @@
+#pragma once
+#include "common.h"
+
+DISABLE_WARNINGS
+#include <cstdio>
+#include <vector>
+ENABLE_WARNINGS
+
+#define MIXER_SAMPLE_RATE 44100
+#define MIXER_CHANNEL_COUNT 2 // Output is always interleaved stereo 16 bit
+#define MIXER_BLOCK_FRAMES 1024
+#define MIXER_VOICE_COUNT 64
+
+// Samples kept as 16 bit, interleaved when stereo. Has to be at MIXER_SAMPLE_RATE, nothing is resampled
+struct MixerSound {
+    std::vector<i16> samples;
+    u32 frame_count;
+    u16 channel_count;
+
+    explicit MixerSound(const u8 *pcm, u32 byte_count, u16 channel_count, u16 bits_per_sample);
+};
+
+struct MixerVoice {
+    const MixerSound *sound; // Not owned
+    u32 cursor;              // In frames
+    f32 gain_left;
+    f32 gain_right;
+    u64 start_order;
+    bool is_active;
+};
+
+// Where the mixed blocks go
+class IMixerSink {
+  public:
+    virtual ~IMixerSink() = default;
+
+    // Blocks it can take right now, for sinks that are played in real time. The others are fed with
+    // Mixer::render and say 0
+    virtual u32 blocks_wanted() {
+        return 0;
+    }
+    virtual void write(const i16 *frames, u32 frame_count) = 0;
+};
+
+// Throws everything away. For headless runs and for timing the mix itself
+class MixerNullSink : public IMixerSink {
+  public:
+    u64 frames_written = 0;
+
+    void write(const i16 *frames, u32 frame_count) override;
+};
+
+// Writes a 16 bit stereo WAV. The sizes in the header are filled in when it's destroyed. When the file
+// can't be opened it says so and acts like MixerNullSink
+class MixerWavSink : public IMixerSink {
+    FILE *file; // Null when it couldn't be opened
+    u32 data_size;
+
+  public:
+    PREVENT_COPY_MOVE(MixerWavSink);
+    explicit MixerWavSink(const char *file_path);
+    ~MixerWavSink() override;
+
+    void write(const i16 *frames, u32 frame_count) override;
+};
+
+// Mixes every playing voice into one stereo stream, 4 samples at a time with SSE. Not thread safe, it's
+// meant to live on whichever thread feeds the sink
+class Mixer {
+    MixerVoice voices[MIXER_VOICE_COUNT];
+    u64 play_count;
+    std::vector<f32> accumulator; // One block, interleaved stereo
+    std::vector<i16> block;
+
+    void mix_voice(MixerVoice &voice, u32 frame_count);
+
+  public:
+    PREVENT_COPY_MOVE(Mixer);
+    Mixer();
+
+    // pan goes from -1 (left) to 1 (right). Steals the oldest voice when all are busy
+    void play(const MixerSound &sound, f32 gain, f32 pan);
+    void mix(i16 *out_frames, u32 frame_count); // At most MIXER_BLOCK_FRAMES
+    void service(IMixerSink &sink);             // As many blocks as the sink wants right now
+    void render(IMixerSink &sink, u32 frame_count); // Exactly this many frames, for offline and headless use
+    u32 get_active_voice_count() const;
+};
@@ -5,10 +5,12 @@ enum class ParticleSystemType {
     PadRight
 };
 
-struct Particle {
-    u32 index;
-    f32 angle;
-    f32 speed_offset; // In percentage
+#define PARTICLE_SIMD_WIDTH 8 // Arrays are padded to this, so the kernel never needs a scalar tail
+
+enum class ParticleSimMode {
+    Cpu, // A ParticleSource per burst, simulated on the CPU and streamed through the particle batch
+    Gpu, // One GpuParticleSystem per type, the state never leaves the GPU. For very large effects
+    Analytic, // One AnalyticParticleSystem per type, positions come from the emit record and the time
 };
 
 struct ParticleProps {
@@ -19,18 +21,29 @@ struct ParticleProps {
     f32 angle_offset;
     f32 speed_offset;
     f32 size;
+    ParticleSimMode sim_mode = ParticleSimMode::Cpu;
+    u32 gpu_capacity = 0; // Only for Gpu and Analytic, how many particles of this type can be alive at once
 };
 
+// Velocity of the i'th particle of a burst. Spreads the burst over the angle limits with some randomness
+Vec2 particle_emit_velocity(const ParticleProps &props, u32 i, Rng &rng);
+
+// Particles are stored as separate arrays. Velocities are computed once at emit, after that the update is
+// a multiply-add over plain float arrays
 struct ParticleSource {
-    Vec2 *positions;
-    Particle *particles;
+    f32 *pos_x;
+    f32 *pos_y;
+    f32 *vel_x;
+    f32 *vel_y;
+    usize capacity; // props.count padded up to PARTICLE_SIMD_WIDTH
     const ParticleProps &props;
     f32 life;
     Vec2 emit_point;
     f32 transparency;
     bool is_alive;
+    Rng rng;
 
-    explicit ParticleSource(const ParticleProps &props, Vec2 emit_point);
+    explicit ParticleSource(const ParticleProps &props, Vec2 emit_point, u64 seed);
 
     ParticleSource(ParticleSource &&rhs);
     ParticleSource &operator=(ParticleSource &&rhs) = delete;
@@ -41,3 +54,65 @@ struct ParticleSource {
 
     void update(f32 dt);
 };
+
+// pos += vel * dt, 4 or 8 particles at a time. count has to be a multiple of PARTICLE_SIMD_WIDTH and the
+// arrays aligned to 32 bytes
+void particle_integrate(f32 *pos_x, f32 *pos_y, const f32 *vel_x, const f32 *vel_y, usize count, f32 dt);
+
+
+#define PARTICLE_CURVE_KEY_COUNT 4
+#define PARTICLE_BUDGET_DEFAULT 65536 // Emitter particles alive at once, engine-wide
+
+// Piecewise linear over the particle's life, keys are evenly spaced from birth to death
+struct ParticleCurve {
+    f32 keys[PARTICLE_CURVE_KEY_COUNT];
+
+    f32 evaluate(f32 t) const; // t is age / lifetime, in [0, 1]
+};
+
+struct ParticleEmitterProps {
+    Vec2 angle_limits;
+    Vec2 lifetime_limits; // Each particle picks its own lifetime in this range
+    f32 spawn_rate;       // Particles per second
+    f32 speed;
+    f32 speed_offset;
+    ParticleCurve size_over_life;
+    ParticleCurve alpha_over_life;
+    usize capacity; // Most particles alive at once. When full, new ones overwrite the oldest
+};
+
+// Keeps spawning while it's emitting. Particles live in a fixed ring: new ones go in at the head, the oldest
+// are at the tail. Dead ones at the tail are dropped by just moving the tail, nothing is ever compacted.
+// Lifetimes differ, so a dead particle in the middle waits for the ones before it and is skipped until then
+struct ParticleEmitter {
+    f32 *pos_x;
+    f32 *pos_y;
+    f32 *vel_x;
+    f32 *vel_y;
+    f32 *age;
+    f32 *lifetime;
+    usize capacity; // Of the arrays, props.capacity padded to PARTICLE_SIMD_WIDTH. The ring is props.capacity
+    u32 oldest;     // Tail of the ring
+    u32 live_count; // Slots in use from the tail on, dead ones in the middle included
+    f32 spawn_accumulator;
+    ParticleEmitterProps props;
+    Vec2 emit_point;
+    bool is_emitting;
+    Rng rng;
+
+    explicit ParticleEmitter(const ParticleEmitterProps &props, Vec2 emit_point, u64 seed);
+
+    ParticleEmitter(ParticleEmitter &&rhs);
+    ParticleEmitter &operator=(ParticleEmitter &&rhs) = delete;
+    ParticleEmitter(const ParticleEmitter &rhs) = delete;
+    ParticleEmitter &operator=(const ParticleEmitter &rhs) = delete;
+
+    ~ParticleEmitter();
+
+    void update(f32 dt);
+    void shed_oldest(u32 count); // Kills the oldest particles early, for the engine's particle budget
+    u32 slot(u32 i) const;       // Ring slot of the i'th particle from the tail
+
+  private:
+    void spawn();
+};
\ No newline at end of file
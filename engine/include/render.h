@@ -4,6 +4,8 @@ DISABLE_WARNINGS
 #include <string>
 #include <array>
 #include <memory>
+#include <vector>
+#include <unordered_map>
 #include <stb_truetype.h>
 #include <stb_image.h>
 ENABLE_WARNINGS
@@ -12,10 +14,21 @@ ENABLE_WARNINGS
 #include "tomath.h"
 #include "shader.h"
 
-#define CHAR_COUNT 96
+#define CHAR_COUNT 96 // Printable ASCII, always resident in the first atlas page
 #define FONT_ATLAS_WIDTH 512
 #define FONT_ATLAS_HEIGHT 256
-#define FONT_TEXT_HEIGHT 50 // In pixels
+#define FONT_ATLAS_PAGE_COUNT 8 // Bounds the atlas memory, whatever the text is
+#define FONT_TEXT_HEIGHT 32 // In pixels. Glyphs are distance fields, they stay crisp at any drawn size
+#define FONT_SDF_PADDING 4  // In pixels, how far the distance field reaches outside the glyph
+#define FONT_SDF_ONEDGE 128 // Distance value that sits right on the outline
+#define FONT_CACHE_MAGIC 0x48435446 // "FTCH"
+#define FONT_CACHE_VERSION 1        // Bump when the baking or the layout below changes
+#define UI_GLYPH_FLOAT_COUNT 20 // 4 vertices, each is pos + uv + atlas page
+#define UI_BATCH_INITIAL_GLYPH_CAPACITY 256
+#define UI_WIDGET_GLYPH_HEADROOM 8 // Extra glyphs reserved on top of the text length
+#define WIDGET_TEXT_CAPACITY 64    // In bytes, including the terminator
+#define PARTICLE_VERT_FLOAT_COUNT 12 // 4 vertices, each is pos + alpha. UVs are in a static buffer
+#define PARTICLE_BATCH_INITIAL_CAPACITY 1024
 
 struct RenderInfo {
     Mat4 view;
@@ -37,18 +50,18 @@ struct Renderer {
     RenderInfo render_info;
     std::shared_ptr<Shader> world_shader;
     std::shared_ptr<Shader> ui_shader;
+    std::unique_ptr<class UiBatch> ui_batch;
+    std::unique_ptr<class ParticleBatch> particle_batch;
+    std::shared_ptr<Shader> particle_sim_shader;
+    std::shared_ptr<Shader> particle_gpu_shader;
+    std::shared_ptr<Shader> particle_analytic_shader;
 
     Renderer(u32 screen_width, u32 screen_height, f32 cam_size);
     ~Renderer() = default;
 
     void begin_frame();
-};
-
-struct TextBufferData {
-    f32 *vb_data;
-    usize vb_len;
-    u32 *ib_data;
-    usize ib_len;
+    void draw_ui(const std::vector<class WidgetRenderUnit *> &units);
+    void draw_particles(std::vector<struct ParticleBatchItem> &items);
 };
 
 enum class TextWidthType {
@@ -67,36 +80,100 @@ struct TextTransform {
     }
 };
 
-struct FontData {
-    u8 *font_bitmap;
+// Baked atlases are written next to the font file. The layout is the header, CHAR_COUNT bakedchars and
+// then the atlas bitmap. Everything before ascent is the key, a mismatch means the atlas is baked again
+struct FontCacheHeader {
+    u32 magic;
+    u32 version;
+    u64 font_hash;
+    u32 text_height;
+    u32 atlas_width;
+    u32 atlas_height;
+    u32 first_char;
+    u32 char_count;
+    u32 sdf_padding;
+    u32 sdf_onedge;
     f32 ascent;  // In pixels
     f32 descent; // In pixels
-    std::array<stbtt_bakedchar, CHAR_COUNT> font_char_data;
+};
 
-    explicit FontData(const std::string &ttf_path);
+struct FontGlyph {
+    stbtt_bakedchar baked;
+    u32 page;
+};
 
-    FontData(FontData &&rhs);
-    FontData(const FontData &) = delete;
-    FontData &operator=(const FontData &) = delete;
+struct FontAtlasShelf {
+    u32 y;
+    u32 height;
+    u32 x_cursor;
+};
 
+struct FontAtlasPage {
+    std::vector<FontAtlasShelf> shelves;
+    u32 shelf_bottom; // First row that no shelf has claimed yet
+    u64 last_used;
+};
+
+struct FontData {
+    texture_handle atlas_texture; // Texture array, a layer per page. Shared by all widgets using this font
+    f32 ascent;                   // In pixels
+    f32 descent;                  // In pixels
+    std::array<stbtt_bakedchar, CHAR_COUNT> font_char_data; // Baked into page 0, which is never evicted
+
+    // Everything outside printable ASCII is rasterised on demand into the other pages. When they are all
+    // full, the least recently used page is emptied
+    u8 *font_bytes;
+    stbtt_fontinfo font_info;
+    f32 scale;
+    std::unordered_map<u32, FontGlyph> glyphs;
+    std::array<FontAtlasPage, FONT_ATLAS_PAGE_COUNT> pages;
+    u64 use_clock;
+    u32 generation; // Bumped on every eviction. Layouts from an older generation may point at stale glyphs
+
+    PREVENT_COPY_MOVE(FontData);
+    explicit FontData(const std::string &ttf_path);
     ~FontData();
+
+    FontGlyph get_glyph(u32 codepoint);
+    void touch_pages(u32 page_mask);
+
+  private:
+    FontGlyph rasterise_glyph(u32 codepoint);
+    bool page_allocate(FontAtlasPage &page, u32 width, u32 height, u32 *out_x, u32 *out_y);
+    u32 evict_lru_page();
 };
 
+enum class WidgetValueType {
+    None,
+    U32,
+    F32,
+};
+
+// Text lives inline, so changing it never allocates. The setters can be called every frame, they only
+// bump the version (which makes the render unit lay it out again) when the shown text actually changes
 struct WidgetData {
-    std::string text;
+    char text[WIDGET_TEXT_CAPACITY];
+    u32 text_length; // In bytes
+    u32 text_version;
     TextTransform transform;
-    const FontData &font_data;
+    FontData &font_data; // Not const, laying out text can add glyphs to the atlas
 
-    explicit WidgetData(const std::string &text, TextTransform transform, const FontData &font_data)
-        : text(text), transform(transform), font_data(font_data) {
-    }
+    // The value the text was last formatted from
+    WidgetValueType value_type;
+    u32 value_u32;
+    f32 value_f32;
+    const char *value_format;
+
+    explicit WidgetData(const std::string &text, TextTransform transform, FontData &font_data);
 
     WidgetData(const WidgetData &) = default;
     WidgetData(WidgetData &&) = default;
     WidgetData &operator=(WidgetData &&) = delete;
     WidgetData &operator=(const WidgetData &) = delete;
 
-    void set_str(u32 integer);
+    void set_text(const char *new_text);
+    void set_u32(u32 value);
+    void set_f32(f32 value, const char *format); // format has to outlive the widget, a literal is fine
 };
 
 class GoRenderUnit {
@@ -123,51 +200,164 @@ class GoRenderUnit {
     void draw(const Mat4 &model);
 };
 
+// CPU side of a widget's text. The GPU side lives in the UiBatch, shared by all widgets
 class WidgetRenderUnit {
+    friend class UiBatch;
+
+    std::vector<f32> vert_data;   // Sized to the capacity, glyphs past the count are zeroed out
+    char laid_out_text[WIDGET_TEXT_CAPACITY]; // What the vertices currently show
+    u32 laid_out_length;
+    u32 laid_out_version;         // WidgetData::text_version the vertices were laid out from
+    texture_handle atlas_texture; // Not owned, FontData has it
+    u32 font_generation;          // Atlas generation the vertices were laid out with
+    u32 page_mask;                // Atlas pages the vertices point into
+    u32 glyph_count;
+    u32 glyph_capacity;
+    u32 dirty_begin; // Glyph range that needs to be uploaded again
+    u32 dirty_end;
+
+  public:
+    explicit WidgetRenderUnit(const WidgetData &widget);
+
+    void text_buffer_fill(f32 *vert_data, FontData &font_data, const char *text, u32 first_glyph,
+                          u32 char_count, TextTransform transform);
+
+    void update(const WidgetData &widget);
+    void refresh(const WidgetData &widget);
+    u32 get_glyph_count() const;
+    u32 get_glyph_capacity() const;
+};
+
+struct UiBatchRange {
+    const WidgetRenderUnit *unit;
+    u32 glyph_offset;
+    u32 glyph_capacity;
+};
+
+// All visible widgets' glyph quads go into one streamed buffer and are drawn with one call per atlas.
+// Each widget gets a range as big as its capacity, and only the glyphs that changed are uploaded again
+class UiBatch {
     buffer_handle vao;
     buffer_handle vbo;
     buffer_handle ibo;
-    u32 index_count;
-    std::weak_ptr<Shader> shader;
-    texture_handle texture;
-
-  public:
-    WidgetRenderUnit(const WidgetRenderUnit &rhs) = default;
-    WidgetRenderUnit &operator=(const WidgetRenderUnit &rhs) = default;
-    WidgetRenderUnit &operator=(WidgetRenderUnit &&rhs) = default;
+    u32 glyph_capacity;
+    std::vector<UiBatchRange> ranges; // Same order as the units of the last draw
+    std::vector<WidgetRenderUnit *> sorted_units;
 
-    explicit WidgetRenderUnit(std::weak_ptr<Shader> shader, const WidgetData &widget);
-    WidgetRenderUnit(WidgetRenderUnit &&rhs);
-    ~WidgetRenderUnit();
+    void reserve(u32 capacity);
 
-    void text_buffer_fill(TextBufferData *text_data, const FontData &font_data, const char *text,
-                          TextTransform transform);
+  public:
+    PREVENT_COPY_MOVE(UiBatch);
+    UiBatch();
+    ~UiBatch();
 
-    void update(const WidgetData &widget);
+    void draw(const std::vector<WidgetRenderUnit *> &units, Shader &shader);
+};
 
-    void draw();
+struct ParticleBatchItem {
+    const struct ParticleSource *source;   // Either a burst
+    const struct ParticleEmitter *emitter; // or an emitter, the other one is null
+    texture_handle texture;
+    u32 particle_count; // Written by the batch, dead emitter particles are left out
 };
 
-class ParticleRenderUnit {
+// Every live emitter writes its quads into its own contiguous range of one engine-wide vertex stream.
+// Alpha is per vertex, so all particles sharing a texture go out in a single draw
+class ParticleBatch {
     buffer_handle vao;
     buffer_handle vbo;
     buffer_handle uv_bo;
     buffer_handle ibo;
-    u32 index_count;
+    u32 particle_capacity;
     std::unique_ptr<Shader> shader;
-    texture_handle texture;
-    u32 vert_data_len;
-    f32 *vert_data;
+    std::vector<f32> vert_data;
+    std::unordered_map<std::string, texture_handle> textures;
+
+    void reserve(u32 capacity);
+
+  public:
+    PREVENT_COPY_MOVE(ParticleBatch);
+    explicit ParticleBatch(RenderInfo render_info);
+    ~ParticleBatch();
+
+    texture_handle get_texture(const std::string &texture_file_name); // Loaded once, owned by the batch
+    void draw(std::vector<ParticleBatchItem> &items);
+};
+
+// Matches the attributes of particle_sim.glsl, which is also what transform feedback writes back
+struct GpuParticle {
+    f32 pos_x;
+    f32 pos_y;
+    f32 vel_x;
+    f32 vel_y;
+    f32 age;
+    f32 lifetime; // Zero for slots that were never emitted into
+};
+
+// Particle state lives in two GPU buffers. Each frame a vertex shader pass reads one and writes the other
+// with transform feedback, then the new state is drawn as instanced quads. The CPU only uploads emits
+class GpuParticleSystem {
+    buffer_handle state_buffers[2];
+    buffer_handle sim_vaos[2];    // Reads the matching state buffer
+    buffer_handle render_vaos[2]; // Draws the matching state buffer
+    buffer_handle quad_vbo;
+    u32 current; // The state buffer with the latest state
+    u32 capacity;
+    u32 emit_cursor; // Ring slot the next particle goes into, overwriting the oldest
+    f32 size;
+    texture_handle texture; // Not owned
+    std::weak_ptr<Shader> sim_shader;
+    std::weak_ptr<Shader> render_shader;
+    std::vector<GpuParticle> emit_scratch;
+    Rng rng;
 
   public:
-    explicit ParticleRenderUnit(usize particle_count, RenderInfo render_info,
-                                const std::string &texture_file_name);
+    PREVENT_COPY_MOVE(GpuParticleSystem);
+    explicit GpuParticleSystem(u32 capacity, f32 size, texture_handle texture,
+                               std::weak_ptr<Shader> sim_shader, std::weak_ptr<Shader> render_shader,
+                               u64 seed);
+    ~GpuParticleSystem();
+
+    void emit_burst(const struct ParticleProps &props, Vec2 emit_point);
+    void update(f32 dt);
+    void draw();
+};
+
+// Matches the per instance attributes of particle_analytic.glsl. Written once at emit, never touched again
+struct AnalyticParticleSeed {
+    f32 emit_x;
+    f32 emit_y;
+    f32 vel_x;
+    f32 vel_y;
+    f32 emit_time;
+    f32 lifetime; // Zero for slots that were never emitted into
+};
+
+#define ANALYTIC_PARTICLE_REBASE_TIME 64.0f // Seconds. An f32 still has ~8us steps there
 
-    ParticleRenderUnit(ParticleRenderUnit &&rhs);
-    ParticleRenderUnit &operator=(ParticleRenderUnit &&rhs) = delete;
-    ParticleRenderUnit(const ParticleRenderUnit &rhs) = delete;
-    ParticleRenderUnit &operator=(const ParticleRenderUnit &rhs) = delete;
+// Burst particles move in straight lines at a constant speed, so their position is just a function of the
+// emit record and the age. The vertex shader does all of it from u_time, there is no per frame update
+class AnalyticParticleSystem {
+    buffer_handle vao;
+    buffer_handle seed_buffer;
+    buffer_handle quad_vbo;
+    u32 capacity;
+    u32 emit_cursor; // Ring slot the next particle goes into, overwriting the oldest
+    f32 size;
+    f32 time; // Seconds. Pulled back to 0 past ANALYTIC_PARTICLE_REBASE_TIME, so f32 stays precise enough
+    texture_handle texture; // Not owned
+    std::weak_ptr<Shader> shader;
+    std::vector<AnalyticParticleSeed> seeds; // Copy of the GPU ring, so the emit times can be rebased
+    Rng rng;
+
+    void rebase_time(); // Shifts time and every emit time down by time, uploads the ring again
+
+  public:
+    PREVENT_COPY_MOVE(AnalyticParticleSystem);
+    explicit AnalyticParticleSystem(u32 capacity, f32 size, texture_handle texture,
+                                    std::weak_ptr<Shader> shader, u64 seed);
+    ~AnalyticParticleSystem();
 
-    ~ParticleRenderUnit();
-    void draw(const struct ParticleSource &ps);
+    void emit_burst(const struct ParticleProps &props, Vec2 emit_point);
+    void draw(f32 dt);
 };
\ No newline at end of file
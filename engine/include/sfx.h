@@ -14,22 +14,59 @@ enum class SfxId {
     SfxStart,
     SfxHitPad,
     SfxHitWall,
-    SfxGameOver
+    SfxGameOver,
+    Count
 };
 
+#define SFX_DEFAULT_GAIN 0.2f
+
 struct SfxAsset {
     SfxId id;
     std::string file_name;
-    SfxAsset(SfxId id, const std::string &file_name) : id(id), file_name(file_name) {
+    u32 priority; // Higher ones steal voices from lower ones when they're all busy
+    f32 gain;
+    SfxAsset(SfxId id, const std::string &file_name, u32 priority = 0, f32 gain = SFX_DEFAULT_GAIN)
+        : id(id), file_name(file_name), priority(priority), gain(gain) {
     }
 };
 
+typedef u32 sfx_stream_handle;
+
+// Where the sounds end up. Picked at startup, pong takes it from --sfx-output
+enum class SfxOutput {
+    Voices,    // An OpenAL source each
+    Mixer,     // Mixed on the audio thread into one OpenAL source
+    MixerWav,  // Mixed into a WAV file in game time, see Sfx::advance. No audio device is opened
+    MixerNull, // Mixed and thrown away, for headless runs. No audio device either
+};
+
+struct SfxSettings {
+    SfxOutput output = SfxOutput::Voices;
+    std::string wav_file_name; // For MixerWav
+};
+
+// Game thread facing side of the audio. Every call here is a single write into a lock-free ring, the
+// audio thread owns the OpenAL context and does the actual work
 class Sfx {
-    std::unique_ptr<struct SfxPlayer> player;
+    std::unique_ptr<struct SfxThread> thread;
+    bool is_headless;
+    double render_frames; // Game time not rendered yet, in frames. Less than one after each advance
 
   public:
     PREVENT_COPY_MOVE(Sfx);
-    Sfx(std::vector<SfxAsset> assets);
+    Sfx(std::vector<SfxAsset> assets, const SfxSettings &settings = SfxSettings());
     ~Sfx();
     void play(SfxId id);
+    void advance(f32 dt); // Headless outputs render dt worth of audio. Once a frame, nothing for the rest
+    void dump_latency(); // Prints the per-sound latency histograms, from the audio thread
+
+    // For music and long ambience, read from the file a chunk at a time instead of loaded whole. Open at load
+    // time, not mid-frame, it's not a ring write
+    sfx_stream_handle stream_open(const std::string &file_name, bool is_looping);
+    void stream_play(sfx_stream_handle stream);
+    void stream_stop(sfx_stream_handle stream);
+
+    // Offline step for assets, not used by the game itself. PCM WAV in, IMA ADPCM WAV out at ~1/4 the size.
+    // Those load and stream like any other WAV
+    static bool encode_adpcm_wav(const std::string &in_file_name, const std::string &out_file_name);
 };
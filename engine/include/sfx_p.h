@@ -1,45 +1,216 @@
 #include <AL/al.h>
 #include <AL/alc.h>
 #include <string>
+#include <atomic>
+#include <thread>
+#include "adpcm.h"
+#include "mixer.h"
 #include "sfx.h"
-#include <unordered_map>
+#include "spsc_ring.h"
+#include "util.h"
 
 typedef ALuint sfx_source_handle;
 typedef ALuint sfx_buffer_handle;
 
-struct WavHeader {
-    u8 _RIFF[4];         // RIFF Header Magic header
-    u32 chunk_size;      // RIFF Chunk Size
-    u8 _WAVE[4];         // WAVE Header
-    u8 _FMT[4];          // FMT header
-    u32 subchunk1_size;  // Size of the fmt chunk
-    u16 audio_format;    // Audio format 1=PCM,6=mulaw,7=alaw, 257=IBM Mu-Law, 258=IBM A-Law, 259=ADPCM
-    u16 channel_count;   // Number of channels 1=Mono 2=Sterio
-    u32 sample_freq;     // Sampling Frequency in Hz
-    u32 bytes_freq;      // bytes per second
-    u16 block_align;     // 2=16-bit mono, 4=16-bit stereo
-    u16 bits_per_sample; // Number of bits per sample
-    u8 _subchunk2_id[4]; // "data"  string
-    u32 sample_data_len; // Sampled data length
+#define WAV_FORMAT_PCM 1
+#define WAV_FORMAT_IMA_ADPCM 0x11
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+// AL_EXT_IMA4 and AL_SOFT_block_alignment, not in our al.h
+#define SFX_AL_FORMAT_MONO_IMA4 0x1300
+#define SFX_AL_FORMAT_STEREO_IMA4 0x1301
+#define SFX_AL_UNPACK_BLOCK_ALIGNMENT_SOFT 0x200C
+
+// What a WAV file says about its samples. data points into the file's bytes, nothing is copied
+struct WavInfo {
+    u16 audio_format;
+    u16 channel_count;
+    u32 sample_freq;
+    u16 block_align; // Bytes per sample frame, all channels. Per block for ADPCM
+    u16 bits_per_sample;
+    u32 frame_count; // For ADPCM from the fact chunk, the last block is padded
+    const u8 *data;
+    u32 data_size;   // Whole frames, or whole blocks for ADPCM
+};
+
+// Walks the RIFF chunks for fmt, fact and data, skipping LIST and whatever else is in there. False if it's
+// not a WAV, or not 8/16 bit PCM or IMA ADPCM, mono/stereo
+bool wav_parse(const u8 *bytes, usize size, WavInfo &out_info);
+
+// Given to OpenAL as-is. Only mono/stereo, 8/16 bit
+ALenum sfx_al_format(u16 channel_count, u16 bits_per_sample);
+
+#define SFX_STREAM_COUNT 4
+#define SFX_STREAM_BUFFER_COUNT 4         // Queued on the source, refilled as they finish playing
+#define SFX_STREAM_CHUNK_BYTES (64 * 1024) // Per buffer. 4 of them is ~1.5s of 44.1kHz stereo 16 bit
+
+// Plays from a mapped file through a few AL buffers in rotation, so the AL side doesn't grow with the track
+// length. Only the pages that were played get read in
+struct SfxStream {
+    MappedFile file;
+    WavInfo wav;
+    u32 cursor; // Into the sample data
+    ALenum format;
+    sfx_source_handle source;
+    sfx_buffer_handle buffers[SFX_STREAM_BUFFER_COUNT];
+    bool is_looping;
+    bool is_active;
+};
+
+#define SFX_MIXER_BUFFER_COUNT 4 // Of MIXER_BLOCK_FRAMES each, ~93ms queued
+
+// Plays the software mixer's output on one streaming source
+class SfxMixerSink : public IMixerSink {
+    sfx_source_handle source;
+    sfx_buffer_handle buffers[SFX_MIXER_BUFFER_COUNT];
+    u32 unqueued_count; // Buffers that were never queued, only at the start
+
+  public:
+    PREVENT_COPY_MOVE(SfxMixerSink);
+    SfxMixerSink();
+    ~SfxMixerSink() override;
+
+    u32 blocks_wanted() override;
+    void write(const i16 *frames, u32 frame_count) override;
+};
+
+#define SFX_VOICE_COUNT 16
+#define SFX_NO_VOICE (-1)
+
+struct SfxSound {
+    sfx_buffer_handle buffer; // 0 when nothing is loaded for that id
+    u32 priority;
+    f32 gain;
+    u32 sample_freq; // To turn AL_SAMPLE_OFFSET into time
+};
+
+// A source from the pool. Free ones are linked through next_free
+struct SfxVoice {
+    sfx_source_handle source;
+    u32 priority;
+    f32 gain;
+    u64 start_order; // Smaller is older
+    i32 next_free;
+    bool is_active;
+
+    // Latency bookkeeping for the sound it's playing
+    SfxId id;
+    u64 issue_ns;           // When the game asked for it
+    bool is_awaiting_output; // Until AL_SAMPLE_OFFSET shows it moving
+};
+
+// Time since Sfx::play
+enum class SfxLatencyStage {
+    Start,  // Until alSourcePlay (or the mixer taking it). Ring, audio thread wake up, voice allocation
+    Output, // Until the first sample was mixed out by OpenAL, worked back from AL_SAMPLE_OFFSET
+    Count
 };
 
+#define SFX_LATENCY_BUCKET_COUNT 20 // Bucket i is [2^i, 2^(i+1)) microseconds, the last one takes the rest
+
+struct SfxLatencyHistogram {
+    u32 buckets[SFX_LATENCY_BUCKET_COUNT];
+    u32 count;
+    u64 total_us;
+    u64 max_us;
+
+    void add(u64 latency_ns);
+    u64 percentile_us(f32 fraction) const; // Upper edge of the bucket it falls in
+};
+
+u64 sfx_now_ns();
+
 struct SfxPlayer {
 
     ALCdevice *device;
     ALCcontext *context;
+    SfxOutput output;
+    bool has_device; // False for the headless outputs, nothing on the OpenAL side is made then
+
+    // All sources are made up front. A sound takes a free one, and when there's none, the one playing the
+    // least important thing is stopped and taken. Sounds no longer have sources of their own, so any number
+    // of them can overlap up to the pool size
+    SfxVoice voices[SFX_VOICE_COUNT];
+    i32 first_free_voice;
+    u64 play_count;
+
+    SfxSound sounds[(usize)SfxId::Count]; // Indexed with the id, no hashing on play
+
+    SfxStream streams[SFX_STREAM_COUNT];
+
+    // Only written and read on the audio thread, dumped from there when asked
+    SfxLatencyHistogram latency[(usize)SfxId::Count][(usize)SfxLatencyStage::Count];
+
+    // ADPCM gets decoded in here, at load and for each stream refill. Only the audio thread touches it
+    std::vector<i16> pcm_pool;
+    bool has_ima4; // OpenAL takes our ADPCM blocks as they are, so they stay compressed in its memory too
 
-    sfx_source_handle source_objects;
-    sfx_source_handle source_startgame;
-    sfx_source_handle source_gameover;
+    // Used instead of the voices by every output but Voices, null then. Same ids as sounds
+    std::unique_ptr<Mixer> mixer;
+    std::unique_ptr<IMixerSink> mixer_sink;
+    std::unique_ptr<MixerSound> mixer_sounds[(usize)SfxId::Count];
 
-    std::unordered_map<SfxId, sfx_buffer_handle> buffers;
+    i32 voice_allocate(u32 priority, f32 gain); // For a sound like this one. SFX_NO_VOICE if none
+    void voices_reclaim(); // Puts the voices that finished playing back on the free list
+    bool stream_fill(SfxStream &stream, sfx_buffer_handle buffer); // False at the end of a non-looping one
+    const i16 *pcm_pool_decode(const WavInfo &wav, u32 first_block, u32 block_count); // Trimmed at the end
 
   public:
-    SfxPlayer(std::vector<SfxAsset> assets);
+    SfxPlayer(std::vector<SfxAsset> assets, const SfxSettings &settings);
     ~SfxPlayer();
 
-    void play(SfxId id);
-    static sfx_buffer_handle create_buffer_with_file(const std::string &file_name);
+    void play(SfxId id, u64 issue_ns);
+    i32 play(sfx_buffer_handle buffer, u32 priority, f32 gain); // SFX_NO_VOICE when none could be taken
+    void stream_start(u32 index, const std::string &file_name, bool is_looping);
+    void stream_stop(u32 index);
+    void streams_service(); // Refills the buffers that finished playing. Often enough to never run dry
+    void mixer_service();   // Same, for the software mixer on the device. The headless sinks want nothing
+    void render(u32 frame_count); // That many frames into a headless sink
+    void latency_service(); // Catches the voices that started producing samples since the last call
+    void latency_dump(const std::vector<SfxAsset> &assets) const;
+    sfx_buffer_handle create_buffer_with_file(const std::string &file_name);
+    std::unique_ptr<MixerSound> create_mixer_sound_with_file(const std::string &file_name);
     static sfx_source_handle create_source(void);
     static void check_al_error(const std::string &msg);
 };
+
+
+#define SFX_COMMAND_RING_CAPACITY 256
+#define SFX_THREAD_SLEEP_MS 1 // Between drains when the ring is empty
+
+enum class SfxCommandType {
+    Play,
+    StreamPlay,
+    StreamStop,
+    LatencyDump,
+    Render,
+};
+
+struct SfxCommand {
+    SfxCommandType type;
+    SfxId id;         // Play
+    u64 issue_ns;     // Play
+    u32 stream_index; // StreamPlay, StreamStop
+    u32 frame_count;  // Render
+};
+
+// The audio thread. Makes the player, so the OpenAL context is current on it and only ever touched from it
+struct SfxThread {
+    SpscRing<SfxCommand, SFX_COMMAND_RING_CAPACITY> commands;
+    std::atomic<bool> is_running;
+    std::vector<SfxAsset> assets;
+    SfxSettings settings;
+    std::thread thread;
+
+    // Written by stream_open before the command that uses them is pushed, the ring orders the two
+    std::string stream_files[SFX_STREAM_COUNT];
+    bool stream_is_looping[SFX_STREAM_COUNT];
+    u32 stream_count;
+
+    PREVENT_COPY_MOVE(SfxThread);
+    explicit SfxThread(std::vector<SfxAsset> assets, SfxSettings settings);
+    ~SfxThread();
+
+    void run();
+    bool drain(SfxPlayer &player); // Runs everything in the ring. False when it was empty
+};
\ No newline at end of file
@@ -4,7 +4,8 @@ class Shader {
     shader_handle handle;
 
   public:
-    explicit Shader(const std::string &file_path);
+    // Varyings are captured with transform feedback, interleaved in the given order
+    explicit Shader(const std::string &file_path, const std::vector<const char *> &feedback_varyings = {});
     ~Shader();
 
     void use();
@@ -0,0 +1,50 @@
+#pragma once
+#pragma warning(disable : 4324) // Padded because of alignas, which is the point
+
+#include "common.h"
+
+DISABLE_WARNINGS
+#include <atomic>
+ENABLE_WARNINGS
+
+// Single producer, single consumer, fixed size, no locks. The producer only writes tail, the consumer only
+// writes head, and each one is on its own cache line so the two threads don't fight over it.
+// Capacity has to be a power of two, one slot is always kept empty to tell full from empty
+template <typename T, u32 Capacity>
+class SpscRing {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity has to be a power of two");
+
+    alignas(64) std::atomic<u32> head; // Next slot to read
+    alignas(64) std::atomic<u32> tail; // Next slot to write
+    alignas(64) T slots[Capacity];
+
+  public:
+    PREVENT_COPY_MOVE(SpscRing);
+    SpscRing() : head(0), tail(0) {
+    }
+
+    // Producer only. False when full, the item is dropped
+    bool push(const T &item) {
+        const u32 write = tail.load(std::memory_order_relaxed);
+        const u32 next = (write + 1) & (Capacity - 1);
+        if (next == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        slots[write] = item;
+        tail.store(next, std::memory_order_release); // Publishes the slot
+        return true;
+    }
+
+    // Consumer only. False when empty
+    bool pop(T &out_item) {
+        const u32 read = head.load(std::memory_order_relaxed);
+        if (read == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        out_item = slots[read];
+        head.store((read + 1) & (Capacity - 1), std::memory_order_release); // Gives the slot back
+        return true;
+    }
+};
@@ -1,33 +1,258 @@
 #pragma once
 #include "common.h"
 
+DISABLE_WARNINGS
+#include <cmath>
+#include <xmmintrin.h>
+ENABLE_WARNINGS
+
 #define DEG2RAD 0.0174533
 
+// Everything small lives in here as inline, so the hot loops don't pay a call per vector op
+
 struct Vec2 {
     float x, y;
 
-    Vec2();
-    explicit Vec2(float x, float y);
+    constexpr Vec2() : x(0), y(0) {
+    }
+    constexpr explicit Vec2(float x, float y) : x(x), y(y) {
+    }
+
+    static constexpr Vec2 zero() {
+        return Vec2(0.0f, 0.0f);
+    }
+    static constexpr Vec2 one() {
+        return Vec2(1.0f, 1.0f);
+    }
+
+    constexpr Vec2 operator+(Vec2 b) const {
+        return Vec2(x + b.x, y + b.y);
+    }
+    constexpr Vec2 operator-(Vec2 b) const {
+        return Vec2(x - b.x, y - b.y);
+    }
+    constexpr Vec2 operator-() const {
+        return Vec2(-x, -y);
+    }
+    constexpr Vec2 operator*(f32 s) const {
+        return Vec2(x * s, y * s);
+    }
+    constexpr Vec2 &operator+=(Vec2 b) {
+        x += b.x;
+        y += b.y;
+        return *this;
+    }
+    constexpr Vec2 &operator-=(Vec2 b) {
+        x -= b.x;
+        y -= b.y;
+        return *this;
+    }
+    constexpr Vec2 &operator*=(f32 s) {
+        x *= s;
+        y *= s;
+        return *this;
+    }
 
-    void normalize();
-    static Vec2 zero();
-    static Vec2 one();
+    constexpr f32 dot(Vec2 b) const {
+        return x * b.x + y * b.y;
+    }
+    constexpr f32 length_sq() const {
+        return x * x + y * y;
+    }
+    f32 length() const {
+        return sqrtf(length_sq());
+    }
 
-    Vec2 operator+(Vec2 b);
-    Vec2 operator*(f32 s);
+    void normalize() {
+        float len = length();
+        x = x / len;
+        y = y / len;
+    }
+    Vec2 normalized() const {
+        Vec2 v = *this;
+        v.normalize();
+        return v;
+    }
+};
+
+struct Vec4 {
+    float x, y, z, w;
+
+    constexpr Vec4() : x(0), y(0), z(0), w(0) {
+    }
+    constexpr explicit Vec4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {
+    }
 };
 
 struct Mat4 {
     float data[16]; // Column major
 
-    void translate_xy(Vec2 vec);
-    Vec2 get_pos_xy() const;
-    void set_pos_xy(Vec2 vec);
-    void set_scale_xy(Vec2 vec);
-    static Mat4 identity();
-    static Mat4 ortho(float left, float right, float bottom, float top, float near, float far);
+    constexpr void translate_xy(Vec2 vec) {
+        data[12] += vec.x;
+        data[13] += vec.y;
+    }
+    constexpr Vec2 get_pos_xy() const {
+        return Vec2(data[12], data[13]);
+    }
+    constexpr void set_pos_xy(Vec2 vec) {
+        data[12] = vec.x;
+        data[13] = vec.y;
+    }
+    constexpr void set_scale_xy(Vec2 vec) {
+        data[0] *= vec.x;
+        data[5] *= vec.y;
+    }
+
+    // Only the xy plane, for z = 0 and w = 1. That's every point in a 2D game
+    constexpr Vec2 transform_point_xy(Vec2 p) const {
+        return Vec2(data[0] * p.x + data[4] * p.y + data[12], data[1] * p.x + data[5] * p.y + data[13]);
+    }
+
+    // For translation, rotation and scale, i.e. the last row is 0 0 0 1. The 3x3 part by cofactors, then the
+    // translation taken back through it
+    constexpr Mat4 inverse_affine() const {
+        const float a00 = data[0], a01 = data[4], a02 = data[8];
+        const float a10 = data[1], a11 = data[5], a12 = data[9];
+        const float a20 = data[2], a21 = data[6], a22 = data[10];
+        const float inv_det = 1.0f / (a00 * (a11 * a22 - a12 * a21) - a01 * (a10 * a22 - a12 * a20) +
+                                      a02 * (a10 * a21 - a11 * a20));
+
+        Mat4 m = Mat4::identity();
+        m.data[0] = (a11 * a22 - a12 * a21) * inv_det;
+        m.data[4] = (a02 * a21 - a01 * a22) * inv_det;
+        m.data[8] = (a01 * a12 - a02 * a11) * inv_det;
+        m.data[1] = (a12 * a20 - a10 * a22) * inv_det;
+        m.data[5] = (a00 * a22 - a02 * a20) * inv_det;
+        m.data[9] = (a02 * a10 - a00 * a12) * inv_det;
+        m.data[2] = (a10 * a21 - a11 * a20) * inv_det;
+        m.data[6] = (a01 * a20 - a00 * a21) * inv_det;
+        m.data[10] = (a00 * a11 - a01 * a10) * inv_det;
+        for (int r = 0; r < 3; r++) {
+            m.data[12 + r] = -(m.data[r] * data[12] + m.data[4 + r] * data[13] + m.data[8 + r] * data[14]);
+        }
+        return m;
+    }
+
+    static constexpr Mat4 identity() {
+        return Mat4{{1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}};
+    }
+
+    static constexpr Mat4 ortho(float left, float right, float bottom, float top, float z_near, float z_far) {
+        Mat4 m = Mat4::identity();
+
+        m.data[0 * 4 + 0] = 2 / (right - left);
+        m.data[1 * 4 + 1] = 2 / (top - bottom);
+        m.data[2 * 4 + 2] = -2 / (z_far - z_near);
+        m.data[3 * 4 + 0] = -(right + left) / (right - left);
+        m.data[3 * 4 + 1] = -(top + bottom) / (top - bottom);
+        m.data[3 * 4 + 2] = -(z_far + z_near) / (z_far - z_near);
+
+        return m;
+    }
 };
 
-float lerp(float a, float b, float t);
-float rand_range(float lo, float hi);
-bool check_line_segment_intersection(Vec2 p1, Vec2 p2, Vec2 p3, Vec2 p4, Vec2 &intersection);
\ No newline at end of file
+// Columns are 4 floats each, so a column of the result is the columns of a weighted by one column of b.
+// Unaligned loads, Mat4 lives in all kinds of structs and is not always 16 byte aligned
+inline Mat4 operator*(const Mat4 &a, const Mat4 &b) {
+    const __m128 a0 = _mm_loadu_ps(a.data + 0);
+    const __m128 a1 = _mm_loadu_ps(a.data + 4);
+    const __m128 a2 = _mm_loadu_ps(a.data + 8);
+    const __m128 a3 = _mm_loadu_ps(a.data + 12);
+
+    Mat4 result;
+    for (u32 col = 0; col < 4; col++) {
+        const f32 *b_col = b.data + col * 4;
+        __m128 r = _mm_mul_ps(a0, _mm_set1_ps(b_col[0]));
+        r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_set1_ps(b_col[1])));
+        r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_set1_ps(b_col[2])));
+        r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_set1_ps(b_col[3])));
+        _mm_storeu_ps(result.data + col * 4, r);
+    }
+    return result;
+}
+
+inline Vec4 operator*(const Mat4 &m, Vec4 v) {
+    __m128 r = _mm_mul_ps(_mm_loadu_ps(m.data + 0), _mm_set1_ps(v.x));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(m.data + 4), _mm_set1_ps(v.y)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(m.data + 8), _mm_set1_ps(v.z)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(m.data + 12), _mm_set1_ps(v.w)));
+
+    Vec4 result;
+    _mm_storeu_ps(&result.x, r);
+    return result;
+}
+
+// Mat4::transform_point_xy over separate x and y arrays, 4 points at a time. out can be the same as in
+inline void transform_points_xy(const Mat4 &m, const f32 *in_x, const f32 *in_y, f32 *out_x, f32 *out_y,
+                                usize count) {
+    const __m128 m0 = _mm_set1_ps(m.data[0]);
+    const __m128 m1 = _mm_set1_ps(m.data[1]);
+    const __m128 m4 = _mm_set1_ps(m.data[4]);
+    const __m128 m5 = _mm_set1_ps(m.data[5]);
+    const __m128 m12 = _mm_set1_ps(m.data[12]);
+    const __m128 m13 = _mm_set1_ps(m.data[13]);
+
+    usize i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 x = _mm_loadu_ps(in_x + i);
+        const __m128 y = _mm_loadu_ps(in_y + i);
+        _mm_storeu_ps(out_x + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, x), _mm_mul_ps(m4, y)), m12));
+        _mm_storeu_ps(out_y + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m1, x), _mm_mul_ps(m5, y)), m13));
+    }
+    for (; i < count; i++) {
+        Vec2 p = m.transform_point_xy(Vec2(in_x[i], in_y[i]));
+        out_x[i] = p.x;
+        out_y[i] = p.y;
+    }
+}
+
+constexpr float lerp(float a, float b, float t) {
+    return a + (b - a) * t;
+}
+
+// xoshiro128+, seeded through splitmix64. Not global, whoever needs randomness owns one, so the same seed
+// always plays out the same way and nothing is shared between threads
+struct Rng {
+    u32 state[4];
+
+    explicit Rng(u64 seed) {
+        for (u32 i = 0; i < 4; i += 2) {
+            seed += 0x9E3779B97F4A7C15ull;
+            u64 z = seed;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            z = z ^ (z >> 31);
+            state[i] = (u32)z;
+            state[i + 1] = (u32)(z >> 32);
+        }
+    }
+
+    u32 next_u32() {
+        const u32 result = state[0] + state[3];
+        const u32 t = state[1] << 9;
+
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = (state[3] << 11) | (state[3] >> 21);
+
+        return result;
+    }
+
+    // Seed for another Rng, e.g. one per particle source
+    u64 next_seed() {
+        const u64 hi = next_u32();
+        return (hi << 32) | next_u32();
+    }
+
+    // [0, 1). The top 24 bits, since the low bits of xoshiro128+ are the weak ones
+    f32 next_f32() {
+        return (f32)(next_u32() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    f32 range(f32 lo, f32 hi) {
+        return lerp(lo, hi, next_f32());
+    }
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include "common.h"
+#include "tomath.h"
+
+#define TRANSFORM_NO_PARENT (-1)
+
+struct TransformNode {
+    i32 parent; // Index into the nodes, always before this one. TRANSFORM_NO_PARENT for roots
+    u32 depth;
+    u32 handle; // Back to the handle, for fixing up the handle table when nodes shift
+    Mat4 local; // Children only, a root's local is its GoData's transform
+    Mat4 world; // Last one written out
+    bool is_dirty;
+    u32 changed_update; // Last update its world changed in. Children compare it to know they have to follow
+    struct GoData *go;
+};
+
+// Parent/child transforms as one flat array, sorted by depth, so every parent is before its children and
+// one pass front to back is enough. Roots are moved by gameplay through GoData::transform as usual, they
+// are compared to last frame's. Children are moved with set_local, their GoData::transform is the output.
+// Only the nodes that changed, or whose parent did, get their matrices multiplied. The parent's scale is
+// inherited too, so offsets given to set_local are in the parent's scaled space
+class TransformHierarchy {
+    std::vector<TransformNode> nodes;
+    std::vector<u32> handle_to_index;
+    u32 first_dirty; // Nothing before this one can have changed since the last update
+    u32 update_count;
+
+  public:
+    PREVENT_COPY_MOVE(TransformHierarchy);
+    TransformHierarchy();
+
+    u32 add_root(struct GoData &go);
+    // The child stays where it is. Its local is worked out from the parent's world as of the last update (a
+    // root's current transform), so it doesn't jump or pick up the parent's scale on attach
+    u32 add_child(struct GoData &go, u32 parent_handle);
+
+    void set_local(u32 handle, const Mat4 &local);
+    void translate_local(u32 handle, Vec2 offset);
+    void update();
+};
@@ -2,8 +2,16 @@
 
 #include "common.h"
 
+// Read-only view of a whole file. data is null when the file couldn't be mapped
+struct MappedFile {
+    const u8 *data;
+    usize size;
+    void *file_handle;    // Only used on Windows
+    void *mapping_handle; // Only used on Windows
+};
+
 struct Util {
-    static u8 *read_file(const char *file_path) {
+    static u8 *read_file(const char *file_path, usize *out_length = nullptr) {
         FILE *f = fopen(file_path, "rb");
         if (!f) {
             printf("failed to open file %s", file_path);
@@ -19,6 +27,70 @@ struct Util {
         fclose(f);
         buffer[length] = 0;
 
+        if (out_length != nullptr) {
+            *out_length = length;
+        }
         return buffer;
     }
+
+    static u64 hash_bytes(const u8 *bytes, usize length) {
+        // FNV-1a
+        u64 hash = 14695981039346656037ull;
+        for (usize i = 0; i < length; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    // Decodes the codepoint at the cursor and moves the cursor past it. Malformed sequences come back as
+    // U+FFFD, one byte at a time. Expects the text to be null terminated
+    static u32 utf8_decode(const char *text, usize *cursor) {
+        const u8 *bytes = (const u8 *)text + *cursor;
+
+        u32 codepoint;
+        usize length;
+        if (bytes[0] < 0x80) {
+            codepoint = bytes[0];
+            length = 1;
+        } else if ((bytes[0] & 0xE0) == 0xC0) {
+            codepoint = bytes[0] & 0x1Fu;
+            length = 2;
+        } else if ((bytes[0] & 0xF0) == 0xE0) {
+            codepoint = bytes[0] & 0x0Fu;
+            length = 3;
+        } else if ((bytes[0] & 0xF8) == 0xF0) {
+            codepoint = bytes[0] & 0x07u;
+            length = 4;
+        } else {
+            *cursor += 1;
+            return 0xFFFD;
+        }
+
+        for (usize i = 1; i < length; i++) {
+            if ((bytes[i] & 0xC0) != 0x80) { // Also stops at the terminator
+                *cursor += i;
+                return 0xFFFD;
+            }
+            codepoint = (codepoint << 6) | (bytes[i] & 0x3Fu);
+        }
+
+        *cursor += length;
+        return codepoint;
+    }
+
+    // Codepoint count of the first byte_count bytes, counted the same way utf8_decode walks them
+    static u32 utf8_length(const char *text, usize byte_count) {
+        u32 length = 0;
+        usize cursor = 0;
+        while (cursor < byte_count) {
+            utf8_decode(text, &cursor);
+            length++;
+        }
+        return length;
+    }
+
+    // Implemented in util.cpp, the platform headers are kept out of everyone else's way
+    static MappedFile map_file(const char *file_path);
+    static void unmap_file(MappedFile &file);
 };
\ No newline at end of file
@@ -0,0 +1,171 @@
+#include "common.h"
+
+DISABLE_WARNINGS
+#include <cassert>
+ENABLE_WARNINGS
+
+#include "adpcm.h"
+
+static const i32 adpcm_index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+static const i32 adpcm_step_table[89] = {
+    7,     8,     9,     10,    11,    12,    13,    14,    16,    17,    19,    21,    23,    25,    28,
+    31,    34,    37,    41,    45,    50,    55,    60,    66,    73,    80,    88,    97,    107,   118,
+    130,   143,   157,   173,   190,   209,   230,   253,   279,   307,   337,   371,   408,   449,   494,
+    544,   598,   658,   724,   796,   876,   963,   1060,  1166,  1282,  1411,  1552,  1707,  1878,  2066,
+    2272,  2499,  2749,  3024,  3327,  3660,  4026,  4428,  4871,  5358,  5894,  6484,  7132,  7845,  8630,
+    9493,  10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+struct AdpcmChannel {
+    i32 predictor;
+    i32 index;
+};
+
+static i16 adpcm_decode_nibble(AdpcmChannel &channel, u8 nibble) {
+    const i32 step = adpcm_step_table[channel.index];
+    i32 diff = step >> 3;
+    if (nibble & 1) {
+        diff += step >> 2;
+    }
+    if (nibble & 2) {
+        diff += step >> 1;
+    }
+    if (nibble & 4) {
+        diff += step;
+    }
+    channel.predictor += (nibble & 8) ? -diff : diff;
+    channel.predictor = channel.predictor < -32768 ? -32768 : channel.predictor;
+    channel.predictor = channel.predictor > 32767 ? 32767 : channel.predictor;
+    channel.index += adpcm_index_table[nibble];
+    channel.index = channel.index < 0 ? 0 : (channel.index > 88 ? 88 : channel.index);
+    return (i16)channel.predictor;
+}
+
+static u8 adpcm_encode_nibble(AdpcmChannel &channel, i16 sample) {
+    // Closest code to the difference, then decoded back so we track exactly what the decoder will see
+    i32 step = adpcm_step_table[channel.index];
+    i32 diff = (i32)sample - channel.predictor;
+    u8 nibble = 0;
+    if (diff < 0) {
+        nibble = 8;
+        diff = -diff;
+    }
+    for (u8 bit = 4; bit > 0; bit >>= 1) {
+        if (diff >= step) {
+            nibble |= bit;
+            diff -= step;
+        }
+        step >>= 1;
+    }
+    adpcm_decode_nibble(channel, nibble);
+    return nibble;
+}
+
+u32 adpcm_frames_per_block(u16 block_align, u16 channel_count) {
+    // After the 4 byte header per channel, every 4 bytes of a channel hold 8 samples
+    return (u32)(block_align - 4 * channel_count) * 2 / channel_count + 1;
+}
+
+void adpcm_decode(const u8 *blocks, u32 block_count, u16 block_align, u16 channel_count, i16 *out_frames) {
+    assert(channel_count == 1 || channel_count == 2);
+    const u32 frames_per_block = adpcm_frames_per_block(block_align, channel_count);
+    const u32 word_count = (frames_per_block - 1) / 8; // Per channel
+
+    for (u32 b = 0; b < block_count; b++) {
+        const u8 *block = blocks + (usize)b * block_align;
+        i16 *out = out_frames + (usize)b * frames_per_block * channel_count;
+
+        AdpcmChannel channels[2];
+        for (u16 c = 0; c < channel_count; c++) {
+            const u8 *header = block + 4 * c;
+            channels[c].predictor = (i16)(header[0] | (header[1] << 8));
+            channels[c].index = header[2] > 88 ? 88 : header[2];
+            out[c] = (i16)channels[c].predictor;
+        }
+
+        // Words alternate between the channels, 4 bytes of one then 4 of the other
+        const u8 *data = block + 4 * channel_count;
+        for (u32 w = 0; w < word_count; w++) {
+            for (u16 c = 0; c < channel_count; c++) {
+                i16 *channel_out = out + (1 + w * 8) * channel_count + c;
+                for (u32 i = 0; i < 4; i++) {
+                    const u8 byte = *data++;
+                    channel_out[(i * 2) * channel_count] = adpcm_decode_nibble(channels[c], byte & 0xF);
+                    channel_out[(i * 2 + 1) * channel_count] = adpcm_decode_nibble(channels[c], byte >> 4);
+                }
+            }
+        }
+    }
+}
+
+// Step index that encodes the first frames of a channel with the least error. Otherwise the first block
+// starts at the smallest step and smears every sharp attack while it catches up
+static i32 adpcm_best_start_index(const i16 *frames, u32 frame_count, u16 channel_count, u16 c) {
+    i32 best_index = 0;
+    f32 best_error = 0.0f;
+    for (i32 index = 0; index <= 88; index++) {
+        AdpcmChannel channel = {frames[c], index};
+        f32 error = 0.0f;
+        for (u32 i = 1; i < frame_count; i++) {
+            const i16 sample = frames[(usize)i * channel_count + c];
+            adpcm_encode_nibble(channel, sample);
+            const f32 diff = (f32)(channel.predictor - sample);
+            error += diff * diff;
+        }
+        if (index == 0 || error < best_error) {
+            best_index = index;
+            best_error = error;
+        }
+    }
+    return best_index;
+}
+
+std::vector<u8> adpcm_encode(const i16 *frames, u32 frame_count, u16 channel_count) {
+    assert(channel_count == 1 || channel_count == 2);
+    const u16 block_align = (u16)(ADPCM_BLOCK_BYTES_PER_CHANNEL * channel_count);
+    const u32 frames_per_block = adpcm_frames_per_block(block_align, channel_count);
+    const u32 word_count = (frames_per_block - 1) / 8;
+    const u32 block_count = (frame_count + frames_per_block - 1) / frames_per_block;
+
+    std::vector<u8> blocks((usize)block_count * block_align);
+    AdpcmChannel channels[2] = {};
+    for (u16 c = 0; c < channel_count; c++) {
+        const u32 search_count = frame_count < frames_per_block ? frame_count : frames_per_block;
+        channels[c].index = adpcm_best_start_index(frames, search_count, channel_count, c);
+    }
+
+    for (u32 b = 0; b < block_count; b++) {
+        u8 *block = blocks.data() + (usize)b * block_align;
+        const u32 first_frame = b * frames_per_block;
+
+        // Past the end it keeps repeating the last frame
+        auto sample_at = [&](u32 frame, u16 c) {
+            frame = frame < frame_count ? frame : frame_count - 1;
+            return frames[(usize)frame * channel_count + c];
+        };
+
+        // The index carries over from the last block, the predictor starts exact
+        for (u16 c = 0; c < channel_count; c++) {
+            const i16 first = sample_at(first_frame, c);
+            channels[c].predictor = first;
+            block[4 * c] = (u8)(first & 0xFF);
+            block[4 * c + 1] = (u8)((first >> 8) & 0xFF);
+            block[4 * c + 2] = (u8)channels[c].index;
+            block[4 * c + 3] = 0;
+        }
+
+        u8 *data = block + 4 * channel_count;
+        for (u32 w = 0; w < word_count; w++) {
+            for (u16 c = 0; c < channel_count; c++) {
+                const u32 frame = first_frame + 1 + w * 8;
+                for (u32 i = 0; i < 4; i++) {
+                    const u8 low = adpcm_encode_nibble(channels[c], sample_at(frame + i * 2, c));
+                    const u8 high = adpcm_encode_nibble(channels[c], sample_at(frame + i * 2 + 1, c));
+                    *data++ = (u8)(low | (high << 4));
+                }
+            }
+        }
+    }
+
+    return blocks;
+}
@@ -8,9 +8,8 @@ void Application::GLFWwindowDestroyer::operator()(GLFWwindow *window) {
     glfwDestroyWindow(window);
 }
 
-Application::Application(std::unique_ptr<IGame> game) : game(std::move(game)) {
-    srand((unsigned long)time(0));
-
+Application::Application(std::unique_ptr<IGame> game, const SfxSettings &sfx_settings)
+    : game(std::move(game)) {
     glfwInit();
 
     glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, true); // To enable debug output
@@ -23,13 +22,17 @@ Application::Application(std::unique_ptr<IGame> game) : game(std::move(game)) {
     window = std::unique_ptr<GLFWwindow, GLFWwindowDestroyer>(window_ptr);
     glfwMakeContextCurrent(window.get());
 
+    // Start and game over are rare and matter more, hits can be cut off for them
     std::vector<SfxAsset> sfx_assets;
-    sfx_assets.emplace_back(SfxId::SfxStart, "assets/Start.Wav");
+    sfx_assets.emplace_back(SfxId::SfxStart, "assets/Start.Wav", 1);
     sfx_assets.emplace_back(SfxId::SfxHitPad, "assets/HitPad.Wav");
     sfx_assets.emplace_back(SfxId::SfxHitWall, "assets/HitWall.Wav");
-    sfx_assets.emplace_back(SfxId::SfxGameOver, "assets/GameOver.Wav");
+    sfx_assets.emplace_back(SfxId::SfxGameOver, "assets/GameOver.Wav", 1);
 
-    engine = std::make_unique<Engine>(screen_width, screen_height, cam_size, sfx_assets);
+    // Printed, so that a match can be played again with the same seed
+    const u64 seed = (u64)time(0);
+    printf("seed %llu\n", (unsigned long long)seed);
+    engine = std::make_unique<Engine>(screen_width, screen_height, cam_size, sfx_assets, seed, sfx_settings);
 }
 
 void Application::loop() {
@@ -39,6 +42,10 @@ void Application::loop() {
 
     game->init(*engine.get());
 
+    // Kept outside the loop so that they don't allocate every frame
+    std::vector<WidgetRenderUnit *> ui_units;
+    std::vector<ParticleBatchItem> particle_items;
+
     Scene &curr_state = engine->all_scenes[0];
     while (!glfwWindowShouldClose(window.get())) {
         dt = (f32)glfwGetTime() - game_time;
@@ -49,21 +56,35 @@ void Application::loop() {
         if (engine->input.just_pressed(KeyCode::Esc)) {
             glfwSetWindowShouldClose(window.get(), true);
         }
+        if (engine->input.just_pressed(KeyCode::Debug1)) {
+            engine->sfx_dump_latency();
+        }
 
         engine->renderer.begin_frame();
 
+        // Picks up whatever moved last frame. Only the objects that changed cells touch the grid
+        engine->broadphase.update_all();
+
         std::optional<std::string> next_state = curr_state.update_func(dt, *engine.get());
+        engine->sfx.advance(dt); // After this frame's sounds were asked for
+
+        // After gameplay moved things, before anything is drawn with them
+        engine->transforms.update();
 
         for (auto go_weak : curr_state.state_gos) {
             std::shared_ptr<GameObject> go_shared = go_weak.lock();
             go_shared->ru.draw(go_shared->data.transform);
         }
 
+        ui_units.clear();
         for (auto widget_weak : curr_state.state_ui) {
             std::shared_ptr<Widget> widget_shared = widget_weak.lock();
-            widget_shared->ru.draw();
+            widget_shared->ru.refresh(widget_shared->data);
+            ui_units.push_back(&widget_shared->ru);
         }
+        engine->renderer.draw_ui(ui_units);
 
+        particle_items.clear();
         std::vector<usize> dead_particle_indices;
         dead_particle_indices.reserve(curr_state.state_particles.size());
         for (usize i = 0; i < curr_state.state_particles.size(); i++) {
@@ -73,11 +94,44 @@ void Application::loop() {
                 continue;
             }
             particle_shared->ps.update(dt);
-            particle_shared->ru.draw(particle_shared->ps);
+
+            ParticleBatchItem item;
+            item.source = &particle_shared->ps;
+            item.emitter = nullptr;
+            item.texture = particle_shared->texture;
+            particle_items.push_back(item);
+        }
+
+        for (auto emitter_weak : curr_state.state_emitters) {
+            emitter_weak.lock()->emitter.update(dt);
+        }
+        engine->enforce_particle_budget();
+        for (auto emitter_weak : curr_state.state_emitters) {
+            std::shared_ptr<Emitter> emitter_shared = emitter_weak.lock();
+
+            ParticleBatchItem item;
+            item.source = nullptr;
+            item.emitter = &emitter_shared->emitter;
+            item.texture = emitter_shared->texture;
+            particle_items.push_back(item);
+        }
+        engine->renderer.draw_particles(particle_items);
+
+        for (auto gpu_particle_weak : curr_state.state_gpu_particles) {
+            std::shared_ptr<GpuParticleSystem> gpu_particle_shared = gpu_particle_weak.lock();
+            gpu_particle_shared->update(dt);
+            gpu_particle_shared->draw();
         }
-        for (usize i = 0; i < dead_particle_indices.size(); i++) {
-            engine->deregister_particle(i);
-            curr_state.state_particles.erase(curr_state.state_particles.begin() + (i64)i);
+
+        for (auto analytic_particle_weak : curr_state.state_analytic_particles) {
+            analytic_particle_weak.lock()->draw(dt);
+        }
+
+        // Backwards, so that erasing doesn't shift the indices we haven't visited yet
+        for (usize i = dead_particle_indices.size(); i > 0; i--) {
+            const usize dead_index = dead_particle_indices[i - 1];
+            engine->deregister_particle(*curr_state.state_particles[dead_index].lock());
+            curr_state.state_particles.erase(curr_state.state_particles.begin() + (i64)dead_index);
         }
 
         if (next_state.has_value()) {
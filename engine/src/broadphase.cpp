@@ -0,0 +1,260 @@
+#include "common.h"
+
+DISABLE_WARNINGS
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+ENABLE_WARNINGS
+
+#include "godata.h"
+#include "collision.h"
+#include "broadphase.h"
+
+Broadphase::Broadphase(f32 cell_size, u32 bucket_count)
+    : cell_size(cell_size), inv_cell_size(1.0f / cell_size), buckets(bucket_count), query_stamp(0) {
+    assert(bucket_count > 0 && (bucket_count & (bucket_count - 1)) == 0);
+}
+
+u32 Broadphase::bucket_index(i32 cell_x, i32 cell_y) const {
+    // The two large primes from Teschner et al., "Optimized Spatial Hashing for Collision Detection of
+    // Deformable Objects"
+    const u32 hash = ((u32)cell_x * 73856093u) ^ ((u32)cell_y * 19349663u);
+    return hash & (u32)(buckets.size() - 1);
+}
+
+i32 Broadphase::cell_coord(f32 pos) const {
+    return (i32)floorf(pos * inv_cell_size);
+}
+
+bool Broadphase::is_in_cell(const BroadphaseProxy &proxy, i32 cell_x, i32 cell_y) const {
+    return cell_x >= proxy.cell_min_x && cell_x <= proxy.cell_max_x && cell_y >= proxy.cell_min_y &&
+           cell_y <= proxy.cell_max_y;
+}
+
+void Broadphase::insert_cells(u32 id) {
+    const BroadphaseProxy &proxy = proxies[id];
+    for (i32 y = proxy.cell_min_y; y <= proxy.cell_max_y; y++) {
+        for (i32 x = proxy.cell_min_x; x <= proxy.cell_max_x; x++) {
+            std::vector<u32> &bucket = buckets[bucket_index(x, y)];
+            // Two of its cells can hash into the same bucket. Once is enough
+            if (bucket.empty() || bucket.back() != id) {
+                bucket.push_back(id);
+            }
+        }
+    }
+}
+
+void Broadphase::remove_cells(u32 id) {
+    const BroadphaseProxy &proxy = proxies[id];
+    for (i32 y = proxy.cell_min_y; y <= proxy.cell_max_y; y++) {
+        for (i32 x = proxy.cell_min_x; x <= proxy.cell_max_x; x++) {
+            std::vector<u32> &bucket = buckets[bucket_index(x, y)];
+            for (usize i = 0; i < bucket.size(); i++) {
+                if (bucket[i] == id) {
+                    bucket[i] = bucket.back(); // Order in a bucket doesn't matter
+                    bucket.pop_back();
+                    break;
+                }
+            }
+        }
+    }
+}
+
+u32 Broadphase::add(const GoData &go) {
+    u32 id;
+    if (!free_proxies.empty()) {
+        id = free_proxies.back();
+        free_proxies.pop_back();
+    } else {
+        id = (u32)proxies.size();
+        proxies.emplace_back();
+    }
+
+    const Rect rect = go.get_world_rect();
+    BroadphaseProxy &proxy = proxies[id];
+    proxy.min = rect.min;
+    proxy.max = rect.max;
+    proxy.cell_min_x = cell_coord(rect.min.x);
+    proxy.cell_min_y = cell_coord(rect.min.y);
+    proxy.cell_max_x = cell_coord(rect.max.x);
+    proxy.cell_max_y = cell_coord(rect.max.y);
+    proxy.go = &go;
+    proxy.query_stamp = 0;
+
+    insert_cells(id);
+    return id;
+}
+
+void Broadphase::remove(u32 id) {
+    remove_cells(id);
+    proxies[id].go = nullptr;
+    free_proxies.push_back(id);
+}
+
+const GoData &Broadphase::get_go(u32 id) const {
+    return *proxies[id].go;
+}
+
+void Broadphase::update(u32 id) {
+    BroadphaseProxy &proxy = proxies[id];
+    const Rect rect = proxy.go->get_world_rect();
+    proxy.min = rect.min;
+    proxy.max = rect.max;
+
+    const i32 cell_min_x = cell_coord(rect.min.x);
+    const i32 cell_min_y = cell_coord(rect.min.y);
+    const i32 cell_max_x = cell_coord(rect.max.x);
+    const i32 cell_max_y = cell_coord(rect.max.y);
+    if (cell_min_x == proxy.cell_min_x && cell_min_y == proxy.cell_min_y && cell_max_x == proxy.cell_max_x &&
+        cell_max_y == proxy.cell_max_y) {
+        return; // Moved within its cells, which is most frames for most objects
+    }
+
+    remove_cells(id);
+    proxy.cell_min_x = cell_min_x;
+    proxy.cell_min_y = cell_min_y;
+    proxy.cell_max_x = cell_max_x;
+    proxy.cell_max_y = cell_max_y;
+    insert_cells(id);
+}
+
+void Broadphase::update_all() {
+    for (u32 id = 0; id < (u32)proxies.size(); id++) {
+        if (proxies[id].go != nullptr) {
+            update(id);
+        }
+    }
+}
+
+void Broadphase::query_pairs(std::vector<BroadphasePair> &out_pairs) {
+    out_pairs.clear();
+
+    for (u32 a = 0; a < (u32)proxies.size(); a++) {
+        const BroadphaseProxy &proxy_a = proxies[a];
+        if (proxy_a.go == nullptr) {
+            continue;
+        }
+
+        for (i32 y = proxy_a.cell_min_y; y <= proxy_a.cell_max_y; y++) {
+            for (i32 x = proxy_a.cell_min_x; x <= proxy_a.cell_max_x; x++) {
+                for (u32 b : buckets[bucket_index(x, y)]) {
+                    if (b <= a) {
+                        continue; // Each pair from its lower id only
+                    }
+
+                    const BroadphaseProxy &proxy_b = proxies[b];
+                    if (!is_in_cell(proxy_b, x, y)) {
+                        continue; // Only shares the bucket, not the cell
+                    }
+
+                    // Two objects can share many cells. Only the min corner of the shared ones reports them
+                    const i32 first_x =
+                        proxy_a.cell_min_x > proxy_b.cell_min_x ? proxy_a.cell_min_x : proxy_b.cell_min_x;
+                    const i32 first_y =
+                        proxy_a.cell_min_y > proxy_b.cell_min_y ? proxy_a.cell_min_y : proxy_b.cell_min_y;
+                    if (x != first_x || y != first_y) {
+                        continue;
+                    }
+
+                    if (proxy_a.min.x <= proxy_b.max.x && proxy_a.max.x >= proxy_b.min.x &&
+                        proxy_a.min.y <= proxy_b.max.y && proxy_a.max.y >= proxy_b.min.y) {
+                        out_pairs.push_back(BroadphasePair{a, b});
+                    }
+                }
+            }
+        }
+    }
+}
+
+void Broadphase::query_rect(Vec2 min, Vec2 max, std::vector<u32> &out_ids) {
+    out_ids.clear();
+    query_stamp++;
+
+    const i32 cell_min_x = cell_coord(min.x);
+    const i32 cell_min_y = cell_coord(min.y);
+    const i32 cell_max_x = cell_coord(max.x);
+    const i32 cell_max_y = cell_coord(max.y);
+    for (i32 y = cell_min_y; y <= cell_max_y; y++) {
+        for (i32 x = cell_min_x; x <= cell_max_x; x++) {
+            for (u32 id : buckets[bucket_index(x, y)]) {
+                BroadphaseProxy &proxy = proxies[id];
+                if (proxy.query_stamp == query_stamp) {
+                    continue;
+                }
+
+                if (proxy.min.x <= max.x && proxy.max.x >= min.x && proxy.min.y <= max.y &&
+                    proxy.max.y >= min.y) {
+                    proxy.query_stamp = query_stamp;
+                    out_ids.push_back(id);
+                }
+            }
+        }
+    }
+}
+
+i32 Broadphase::raycast(Vec2 from, Vec2 displacement, SweepHit &out_hit) const {
+    // Amanatides & Woo grid walk. t_max_* is where the ray crosses into the next column/row, t_delta_* is how
+    // far apart those crossings are
+    i32 cell_x = cell_coord(from.x);
+    i32 cell_y = cell_coord(from.y);
+    const i32 end_x = cell_coord(from.x + displacement.x);
+    const i32 end_y = cell_coord(from.y + displacement.y);
+    const i32 step_x = displacement.x > 0.0f ? 1 : -1;
+    const i32 step_y = displacement.y > 0.0f ? 1 : -1;
+
+    f32 t_max_x = FLT_MAX;
+    f32 t_max_y = FLT_MAX;
+    f32 t_delta_x = FLT_MAX;
+    f32 t_delta_y = FLT_MAX;
+    if (displacement.x != 0.0f) {
+        const f32 next_edge_x = (f32)(cell_x + (step_x > 0 ? 1 : 0)) * cell_size;
+        t_max_x = (next_edge_x - from.x) / displacement.x;
+        t_delta_x = cell_size / fabsf(displacement.x);
+    }
+    if (displacement.y != 0.0f) {
+        const f32 next_edge_y = (f32)(cell_y + (step_y > 0 ? 1 : 0)) * cell_size;
+        t_max_y = (next_edge_y - from.y) / displacement.y;
+        t_delta_y = cell_size / fabsf(displacement.y);
+    }
+
+    i32 best_id = -1;
+    SweepHit best_hit;
+    best_hit.toi = FLT_MAX;
+    while (true) {
+        for (u32 id : buckets[bucket_index(cell_x, cell_y)]) {
+            const BroadphaseProxy &proxy = proxies[id];
+            if (!is_in_cell(proxy, cell_x, cell_y)) {
+                continue;
+            }
+
+            Rect box(Vec2::zero(), Vec2::zero());
+            box.min = proxy.min;
+            box.max = proxy.max;
+            SweepHit hit;
+            if (sweep_point_aabb(from, displacement, box, hit) && hit.toi < best_hit.toi) {
+                best_hit = hit;
+                best_id = (i32)id;
+            }
+        }
+
+        // Anything in the later cells is hit after this cell's exit. Done if we already have a hit before it
+        const f32 t_cell_exit = t_max_x < t_max_y ? t_max_x : t_max_y;
+        if ((best_id != -1 && best_hit.toi <= t_cell_exit) || (cell_x == end_x && cell_y == end_y) ||
+            t_cell_exit > 1.0f) {
+            break;
+        }
+
+        if (t_max_x < t_max_y) {
+            cell_x += step_x;
+            t_max_x += t_delta_x;
+        } else {
+            cell_y += step_y;
+            t_max_y += t_delta_y;
+        }
+    }
+
+    if (best_id != -1) {
+        out_hit = best_hit;
+    }
+    return best_id;
+}
@@ -0,0 +1,256 @@
+#include "common.h"
+
+DISABLE_WARNINGS
+#include <cfloat>
+#include <cmath>
+#include <xmmintrin.h>
+ENABLE_WARNINGS
+
+#include "godata.h"
+#include "collision.h"
+
+// Entry and exit times of one axis. A zero displacement never enters or leaves, so it's either always in
+// the slab or never
+static bool slab_times(f32 from, f32 displacement, f32 min, f32 max, f32 &t_enter, f32 &t_exit) {
+    if (displacement == 0.0f) {
+        t_enter = -INFINITY;
+        t_exit = INFINITY;
+        return from >= min && from <= max;
+    }
+
+    const f32 inv = 1.0f / displacement;
+    const f32 t_min = (min - from) * inv;
+    const f32 t_max = (max - from) * inv;
+    t_enter = t_min < t_max ? t_min : t_max;
+    t_exit = t_min < t_max ? t_max : t_min;
+    return true;
+}
+
+bool sweep_point_aabb(Vec2 from, Vec2 displacement, const Rect &box, SweepHit &out_hit) {
+    f32 enter_x, exit_x, enter_y, exit_y;
+    if (!slab_times(from.x, displacement.x, box.min.x, box.max.x, enter_x, exit_x) ||
+        !slab_times(from.y, displacement.y, box.min.y, box.max.y, enter_y, exit_y)) {
+        return false;
+    }
+
+    const f32 t_enter = enter_x > enter_y ? enter_x : enter_y;
+    const f32 t_exit = exit_x < exit_y ? exit_x : exit_y;
+    if (t_enter > t_exit || t_exit <= 0.0f || t_enter > 1.0f) { // Exit at 0 is touching and moving away
+        return false;
+    }
+
+    if (t_enter < 0.0f) {
+        // Already inside. Push out through the closest face
+        const f32 left = from.x - box.min.x;
+        const f32 right = box.max.x - from.x;
+        const f32 bottom = from.y - box.min.y;
+        const f32 top = box.max.y - from.y;
+        const f32 closest_x = left < right ? left : right;
+        const f32 closest_y = bottom < top ? bottom : top;
+
+        out_hit.toi = 0.0f;
+        if (closest_x < closest_y) {
+            out_hit.normal = Vec2(left < right ? -1.0f : 1.0f, 0.0f);
+        } else {
+            out_hit.normal = Vec2(0.0f, bottom < top ? -1.0f : 1.0f);
+        }
+
+        // Only when moving in through that face. On its way out (e.g. snapped to the face last tick and a
+        // rounding error put it inside) or sliding along it, there's nothing to reflect and the hit would
+        // come back at 0 every sweep
+        return displacement.dot(out_hit.normal) < 0.0f;
+    }
+
+    out_hit.toi = t_enter;
+    if (enter_x > enter_y) {
+        out_hit.normal = Vec2(displacement.x > 0.0f ? -1.0f : 1.0f, 0.0f);
+    } else {
+        out_hit.normal = Vec2(0.0f, displacement.y > 0.0f ? -1.0f : 1.0f);
+    }
+    return true;
+}
+
+bool sweep_aabb_aabb(const Rect &mover, Vec2 displacement, const Rect &box, SweepHit &out_hit) {
+    const Vec2 half_size = (mover.max - mover.min) * 0.5f;
+    const Vec2 center = mover.min + half_size;
+
+    Rect grown = box;
+    grown.min -= half_size;
+    grown.max += half_size;
+    return sweep_point_aabb(center, displacement, grown, out_hit);
+}
+
+// Exact per box answers for [begin, end), keeping the earliest. The SIMD path's tail and its fallback
+static void sweep_point_aabbs_scalar(Vec2 from, Vec2 displacement, const f32 *min_x, const f32 *min_y,
+                                     const f32 *max_x, const f32 *max_y, usize begin, usize end,
+                                     i32 &best_index, SweepHit &best_hit) {
+    for (usize i = begin; i < end; i++) {
+        Rect box(Vec2::zero(), Vec2::zero());
+        box.min = Vec2(min_x[i], min_y[i]);
+        box.max = Vec2(max_x[i], max_y[i]);
+
+        SweepHit hit;
+        if (sweep_point_aabb(from, displacement, box, hit) && (best_index == -1 || hit.toi < best_hit.toi)) {
+            best_hit = hit;
+            best_index = (i32)i;
+        }
+    }
+}
+
+// Slab entry and exit of one axis for 4 boxes. A zero displacement is always in the slab or never, like
+// slab_times, instead of the NaN that 0 * inf would give on the edge
+static void slab_times_4(__m128 from_4, f32 displacement, __m128 min_4, __m128 max_4, __m128 &t_enter,
+                         __m128 &t_exit, __m128 &is_in_slab) {
+    const __m128 inf_4 = _mm_set1_ps(INFINITY);
+    if (displacement == 0.0f) {
+        t_enter = _mm_sub_ps(_mm_setzero_ps(), inf_4);
+        t_exit = inf_4;
+        is_in_slab = _mm_and_ps(_mm_cmpge_ps(from_4, min_4), _mm_cmple_ps(from_4, max_4));
+        return;
+    }
+
+    const __m128 inv_4 = _mm_set1_ps(1.0f / displacement);
+    const __m128 t_min = _mm_mul_ps(_mm_sub_ps(min_4, from_4), inv_4);
+    const __m128 t_max = _mm_mul_ps(_mm_sub_ps(max_4, from_4), inv_4);
+    t_enter = _mm_min_ps(t_min, t_max);
+    t_exit = _mm_max_ps(t_min, t_max);
+    is_in_slab = _mm_cmpeq_ps(t_enter, t_enter); // All set
+}
+
+// -a where the mask is set, a elsewhere
+static __m128 negate_where(__m128 mask, __m128 a) {
+    return _mm_xor_ps(a, _mm_and_ps(mask, _mm_set1_ps(-0.0f)));
+}
+
+i32 sweep_point_aabbs(Vec2 from, Vec2 displacement, const f32 *min_x, const f32 *min_y, const f32 *max_x,
+                      const f32 *max_y, usize count, SweepHit &out_hit) {
+    i32 best_index = -1;
+    f32 best_toi = INFINITY;
+
+    const __m128 from_x_4 = _mm_set1_ps(from.x);
+    const __m128 from_y_4 = _mm_set1_ps(from.y);
+    const __m128 displacement_x_4 = _mm_set1_ps(displacement.x);
+    const __m128 displacement_y_4 = _mm_set1_ps(displacement.y);
+    const __m128 zero_4 = _mm_setzero_ps();
+    const __m128 one_4 = _mm_set1_ps(1.0f);
+
+    usize i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m128 min_x_4 = _mm_loadu_ps(min_x + i);
+        const __m128 min_y_4 = _mm_loadu_ps(min_y + i);
+        const __m128 max_x_4 = _mm_loadu_ps(max_x + i);
+        const __m128 max_y_4 = _mm_loadu_ps(max_y + i);
+
+        __m128 enter_x, exit_x, in_slab_x, enter_y, exit_y, in_slab_y;
+        slab_times_4(from_x_4, displacement.x, min_x_4, max_x_4, enter_x, exit_x, in_slab_x);
+        slab_times_4(from_y_4, displacement.y, min_y_4, max_y_4, enter_y, exit_y, in_slab_y);
+        const __m128 t_enter = _mm_max_ps(enter_x, enter_y);
+        const __m128 t_exit = _mm_min_ps(exit_x, exit_y);
+
+        // Same rules as sweep_point_aabb
+        const __m128 is_in_slabs = _mm_and_ps(in_slab_x, in_slab_y);
+        const __m128 is_overlapping = _mm_and_ps(is_in_slabs, _mm_cmple_ps(t_enter, t_exit));
+        const __m128 is_in_range = _mm_and_ps(_mm_cmpgt_ps(t_exit, zero_4), _mm_cmple_ps(t_enter, one_4));
+        __m128 is_hit = _mm_and_ps(is_overlapping, is_in_range);
+        if (_mm_movemask_ps(is_hit) == 0) {
+            continue; // The common case, nothing in these 4
+        }
+
+        // Starting inside only counts when moving in through the closest face, not out or along it
+        const __m128 left = _mm_sub_ps(from_x_4, min_x_4);
+        const __m128 right = _mm_sub_ps(max_x_4, from_x_4);
+        const __m128 bottom = _mm_sub_ps(from_y_4, min_y_4);
+        const __m128 top = _mm_sub_ps(max_y_4, from_y_4);
+        const __m128 is_face_x = _mm_cmplt_ps(_mm_min_ps(left, right), _mm_min_ps(bottom, top));
+        const __m128 out_x = negate_where(_mm_cmplt_ps(left, right), displacement_x_4); // displacement.normal
+        const __m128 out_y = negate_where(_mm_cmplt_ps(bottom, top), displacement_y_4);
+        const __m128 out_along_normal =
+            _mm_or_ps(_mm_and_ps(is_face_x, out_x), _mm_andnot_ps(is_face_x, out_y));
+        const __m128 is_inside = _mm_cmplt_ps(t_enter, zero_4);
+        const __m128 is_moving_out = _mm_and_ps(is_inside, _mm_cmpge_ps(out_along_normal, zero_4));
+        is_hit = _mm_andnot_ps(is_moving_out, is_hit);
+
+        const i32 hit_mask = _mm_movemask_ps(is_hit);
+        f32 toi[4];
+        _mm_storeu_ps(toi, _mm_max_ps(t_enter, zero_4));
+        for (i32 lane = 0; lane < 4; lane++) {
+            if ((hit_mask & (1 << lane)) && toi[lane] < best_toi) {
+                best_toi = toi[lane];
+                best_index = (i32)i + lane;
+            }
+        }
+    }
+
+    // The winner goes through the scalar version for its normal. Same math, so it agrees. If it somehow
+    // doesn't, everything is done again exactly rather than returning a hit without a normal
+    SweepHit best_hit;
+    if (best_index != -1) {
+        const usize winner = (usize)best_index;
+        best_index = -1;
+        sweep_point_aabbs_scalar(from, displacement, min_x, min_y, max_x, max_y, winner, winner + 1,
+                                 best_index, best_hit);
+        if (best_index == -1) {
+            sweep_point_aabbs_scalar(from, displacement, min_x, min_y, max_x, max_y, 0, i, best_index,
+                                     best_hit);
+        }
+    }
+    sweep_point_aabbs_scalar(from, displacement, min_x, min_y, max_x, max_y, i, count, best_index, best_hit);
+
+    if (best_index != -1) {
+        out_hit = best_hit;
+    }
+    return best_index;
+}
+
+u32 sweep_and_bounce(Vec2 &position, Vec2 half_size, Vec2 &velocity, f32 dt, const Rect *boxes,
+                     usize box_count, CollisionBounce *out_bounces, u32 max_bounces,
+                     collision_bounce_func on_bounce, void *context) {
+    f32 time_left = dt;
+    u32 bounce_count = 0;
+
+    while (time_left > 0.0f) {
+        const Vec2 displacement = velocity * time_left;
+        Rect mover(position, half_size * 2.0f);
+
+        i32 hit_index = -1;
+        SweepHit earliest_hit;
+        earliest_hit.toi = FLT_MAX;
+        for (usize i = 0; i < box_count; i++) {
+            SweepHit hit;
+            if (sweep_aabb_aabb(mover, displacement, boxes[i], hit) && hit.toi < earliest_hit.toi) {
+                earliest_hit = hit;
+                hit_index = (i32)i;
+            }
+        }
+
+        if (hit_index == -1) {
+            position += displacement;
+            break;
+        }
+
+        if (bounce_count == max_bounces) {
+            break; // Jammed between things. Better to stay put than to go through one of them
+        }
+
+        position += displacement * earliest_hit.toi;
+        time_left *= 1.0f - earliest_hit.toi;
+
+        // The sweeps only report hits moving into the face. One that doesn't would be found again at the
+        // same spot every loop, so the rest of the tick is spent in place instead of bouncing in place
+        const f32 into_normal = velocity.dot(earliest_hit.normal);
+        if (into_normal >= 0.0f) {
+            break;
+        }
+        velocity -= earliest_hit.normal * (2.0f * into_normal);
+
+        CollisionBounce &bounce = out_bounces[bounce_count++];
+        bounce.box_index = (u32)hit_index;
+        bounce.position = position;
+        bounce.normal = earliest_hit.normal;
+        if (on_bounce != nullptr) {
+            on_bounce(bounce, velocity, context);
+        }
+    }
+
+    return bounce_count;
+}
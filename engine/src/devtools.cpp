@@ -0,0 +1,684 @@
+#include "common.h"
+
+DISABLE_WARNINGS
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <immintrin.h>
+#include <vector>
+ENABLE_WARNINGS
+
+#include "tomath.h"
+#include "particle.h"
+#include "godata.h"
+#include "collision.h"
+#include "broadphase.h"
+#include "transform.h"
+#include "sfx_p.h"
+#include "devtools.h"
+
+// For the --test- ones. Prints and counts, so a run shows every failure rather than the first
+#define DEVTOOL_CHECK(failure_count, condition)                                                              \
+    do {                                                                                                     \
+        if (!(condition)) {                                                                                  \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition);                             \
+            (failure_count)++;                                                                               \
+        }                                                                                                    \
+    } while (0)
+
+static int devtool_report(const char *name, u32 failure_count) {
+    printf("%s: %s\n", name, failure_count == 0 ? "ok" : "FAILED");
+    return failure_count == 0 ? 0 : 1;
+}
+
+static double devtool_now_ms() {
+    const auto since_epoch = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration<double, std::milli>(since_epoch).count();
+}
+
+// SoA particle_integrate against the array of structs loop it replaced
+static int bench_particles(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    const usize count = 1 << 20;
+    const u32 iteration_count = 200;
+    const f32 dt = 1.0f / 60.0f;
+
+    struct AosParticle {
+        Vec2 position;
+        Vec2 velocity;
+    };
+    std::vector<AosParticle> aos(count);
+    f32 *soa = (f32 *)_mm_malloc(4 * count * sizeof(f32), 32);
+    f32 *pos_x = soa;
+    f32 *pos_y = pos_x + count;
+    f32 *vel_x = pos_y + count;
+    f32 *vel_y = vel_x + count;
+
+    Rng rng(1);
+    for (usize i = 0; i < count; i++) {
+        const Vec2 velocity(rng.range(-1.0f, 1.0f), rng.range(-1.0f, 1.0f));
+        aos[i].position = Vec2(0.0f, 0.0f);
+        aos[i].velocity = velocity;
+        pos_x[i] = 0.0f;
+        pos_y[i] = 0.0f;
+        vel_x[i] = velocity.x;
+        vel_y[i] = velocity.y;
+    }
+
+    double start = devtool_now_ms();
+    for (u32 iteration = 0; iteration < iteration_count; iteration++) {
+        for (AosParticle &particle : aos) {
+            particle.position += particle.velocity * dt;
+        }
+    }
+    const double aos_ms = (devtool_now_ms() - start) / iteration_count;
+
+    start = devtool_now_ms();
+    for (u32 iteration = 0; iteration < iteration_count; iteration++) {
+        particle_integrate(pos_x, pos_y, vel_x, vel_y, count, dt);
+    }
+    const double soa_ms = (devtool_now_ms() - start) / iteration_count;
+
+    // Both have to end up in the same place, also keeps the loops from being thrown away
+    f32 max_diff = 0.0f;
+    for (usize i = 0; i < count; i++) {
+        const f32 diff = fabsf(aos[i].position.x - pos_x[i]) + fabsf(aos[i].position.y - pos_y[i]);
+        max_diff = diff > max_diff ? diff : max_diff;
+    }
+    _mm_free(soa);
+
+    printf("%zu particles, ms per update. aos: %.3f, soa %s: %.3f (%.2fx). max diff %g\n", count, aos_ms,
+#if defined(__AVX__)
+           "avx",
+#else
+           "sse",
+#endif
+           soa_ms, aos_ms / soa_ms, max_diff);
+    return 0;
+}
+
+// Reference for sweep_point_aabbs, one box at a time through the scalar sweep
+static i32 sweep_point_aabbs_reference(Vec2 from, Vec2 displacement, const std::vector<Rect> &boxes,
+                                       SweepHit &out_hit) {
+    i32 best_index = -1;
+    for (usize i = 0; i < boxes.size(); i++) {
+        SweepHit hit;
+        if (!sweep_point_aabb(from, displacement, boxes[i], hit)) {
+            continue;
+        }
+        if (best_index == -1 || hit.toi < out_hit.toi) {
+            out_hit = hit;
+            best_index = (i32)i;
+        }
+    }
+    return best_index;
+}
+
+static i32 sweep_point_aabbs_of(Vec2 from, Vec2 displacement, const std::vector<Rect> &boxes,
+                                SweepHit &out_hit) {
+    std::vector<f32> min_x, min_y, max_x, max_y;
+    for (const Rect &box : boxes) {
+        min_x.push_back(box.min.x);
+        min_y.push_back(box.min.y);
+        max_x.push_back(box.max.x);
+        max_y.push_back(box.max.y);
+    }
+    return sweep_point_aabbs(from, displacement, min_x.data(), min_y.data(), max_x.data(), max_y.data(),
+                             boxes.size(), out_hit);
+}
+
+static Rect devtool_rect(f32 min_x, f32 min_y, f32 max_x, f32 max_y) {
+    Rect rect(Vec2::zero(), Vec2::zero());
+    rect.min = Vec2(min_x, min_y);
+    rect.max = Vec2(max_x, max_y);
+    return rect;
+}
+
+static int test_collision(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    u32 failure_count = 0;
+    SweepHit hit;
+
+    // Inside near the right face, moving out through it is not a hit. Moving back in is, at 0
+    const Rect inside_box = devtool_rect(0.0f, 0.0f, 2.0f, 2.0f);
+    const Vec2 inside_from(1.9f, 1.0f);
+    DEVTOOL_CHECK(failure_count, !sweep_point_aabb(inside_from, Vec2(10.0f, 0.0f), inside_box, hit));
+    DEVTOOL_CHECK(failure_count, sweep_point_aabb(inside_from, Vec2(-10.0f, 0.0f), inside_box, hit));
+    DEVTOOL_CHECK(failure_count, hit.toi == 0.0f && hit.normal.x == 1.0f && hit.normal.y == 0.0f);
+
+    // Same on the SIMD path, with the box it's leaving in a lane and in the tail. The real hit further along
+    // has to win, with its own normal
+    const Rect far_box = devtool_rect(5.0f, 0.0f, 6.0f, 2.0f);
+    const Rect away_box = devtool_rect(-50.0f, -50.0f, -40.0f, -40.0f);
+    const std::vector<Rect> in_lane = {inside_box, far_box, away_box, away_box};
+    const std::vector<Rect> in_tail = {away_box, far_box, away_box, away_box, inside_box};
+    for (const std::vector<Rect> *boxes : {&in_lane, &in_tail}) {
+        hit.normal = Vec2::zero();
+        DEVTOOL_CHECK(failure_count, sweep_point_aabbs_of(inside_from, Vec2(10.0f, 0.0f), *boxes, hit) == 1);
+        DEVTOOL_CHECK(failure_count, fabsf(hit.toi - 0.31f) < 1e-5f);
+        DEVTOOL_CHECK(failure_count, hit.normal.x == -1.0f && hit.normal.y == 0.0f);
+    }
+
+    // Inside and moving along the closest face, like a pad moved onto the ball from above. Not a hit, or it's
+    // found again at 0 on every sweep and the ball gets stuck bouncing in place
+    const Vec2 along_from(1.0f, 1.9f);
+    const Vec2 along(10.0f, 0.0f);
+    DEVTOOL_CHECK(failure_count, !sweep_point_aabb(along_from, along, inside_box, hit));
+    const Rect along_mover = devtool_rect(0.9f, 1.8f, 1.1f, 2.0f);
+    DEVTOOL_CHECK(failure_count, !sweep_aabb_aabb(along_mover, along, inside_box, hit));
+    const std::vector<Rect> along_in_lane = {inside_box, away_box, away_box, away_box};
+    DEVTOOL_CHECK(failure_count, sweep_point_aabbs_of(along_from, along, along_in_lane, hit) == -1);
+
+    Vec2 position(1.0f, 1.9f);
+    Vec2 velocity(1.0f, 0.0f);
+    CollisionBounce bounces[COLLISION_MAX_BOUNCES];
+    const u32 bounce_count = sweep_and_bounce(position, Vec2(0.1f, 0.1f), velocity, 0.5f, &inside_box, 1,
+                                              bounces, COLLISION_MAX_BOUNCES);
+    DEVTOOL_CHECK(failure_count, bounce_count == 0);
+    DEVTOOL_CHECK(failure_count, fabsf(position.x - 1.5f) < 1e-5f && velocity.x == 1.0f);
+
+    // And everything else matches the scalar reference. Coordinates on a coarse grid, so there are plenty
+    // of starts on an edge and zero displacements on an axis
+    Rng rng(7);
+    auto grid = [&rng]() { return (f32)(i32)rng.range(-8.0f, 8.0f) * 0.5f; };
+    u32 mismatch_count = 0;
+    for (u32 round = 0; round < 20000; round++) {
+        std::vector<Rect> boxes;
+        const u32 box_count = 1 + rng.next_u32() % 11;
+        for (u32 b = 0; b < box_count; b++) {
+            const f32 x = grid();
+            const f32 y = grid();
+            boxes.push_back(devtool_rect(x, y, x + 0.5f + fabsf(grid()), y + 0.5f + fabsf(grid())));
+        }
+        const Vec2 from(grid(), grid());
+        const Vec2 displacement(grid(), grid());
+
+        SweepHit expected;
+        SweepHit actual;
+        const i32 expected_index = sweep_point_aabbs_reference(from, displacement, boxes, expected);
+        const i32 actual_index = sweep_point_aabbs_of(from, displacement, boxes, actual);
+        const bool is_same = expected_index == actual_index &&
+                             (expected_index == -1 || (expected.toi == actual.toi &&
+                                                       expected.normal.x == actual.normal.x &&
+                                                       expected.normal.y == actual.normal.y));
+        mismatch_count += is_same ? 0 : 1;
+    }
+    DEVTOOL_CHECK(failure_count, mismatch_count == 0);
+
+    return devtool_report("collision", failure_count);
+}
+
+// Spatial hash against checking every pair. Optional argument: object count, 20000 by default. The brute
+// force side is quadratic, so it gets slow quickly past that
+static int bench_broadphase(int argc, char **argv) {
+    const u32 count = argc >= 1 ? (u32)atoi(argv[0]) : 20000;
+    if (count < 2) {
+        printf("Need at least 2 objects\n");
+        return 1;
+    }
+
+    // About one object per cell, each at most a cell big
+    const f32 extent = sqrtf((f32)count) * BROADPHASE_DEFAULT_CELL_SIZE * 0.5f;
+    Rng rng(3);
+    std::vector<GoData> gos;
+    gos.reserve(count); // The broadphase keeps pointers to these
+    for (u32 i = 0; i < count; i++) {
+        const Vec2 pos(rng.range(-extent, extent), rng.range(-extent, extent));
+        const Vec2 size(rng.range(0.2f, 1.0f), rng.range(0.2f, 1.0f));
+        gos.emplace_back(pos, size);
+    }
+
+    Broadphase broadphase;
+    double start = devtool_now_ms();
+    for (const GoData &go : gos) {
+        broadphase.add(go);
+    }
+    const double add_ms = devtool_now_ms() - start;
+
+    std::vector<BroadphasePair> pairs;
+    start = devtool_now_ms();
+    broadphase.query_pairs(pairs);
+    const double hash_ms = devtool_now_ms() - start;
+
+    start = devtool_now_ms();
+    std::vector<Rect> rects;
+    rects.reserve(count);
+    for (const GoData &go : gos) {
+        rects.push_back(go.get_world_rect());
+    }
+    std::vector<BroadphasePair> brute_pairs;
+    for (u32 a = 0; a < count; a++) {
+        for (u32 b = a + 1; b < count; b++) {
+            if (rects[a].min.x <= rects[b].max.x && rects[b].min.x <= rects[a].max.x &&
+                rects[a].min.y <= rects[b].max.y && rects[b].min.y <= rects[a].max.y) {
+                brute_pairs.push_back(BroadphasePair{a, b});
+            }
+        }
+    }
+    const double brute_ms = devtool_now_ms() - start;
+
+    // Same set of pairs, whatever the order. Ids are the add order since nothing was removed
+    auto canonical = [](std::vector<BroadphasePair> &list) {
+        for (BroadphasePair &pair : list) {
+            if (pair.a > pair.b) {
+                std::swap(pair.a, pair.b);
+            }
+        }
+        std::sort(list.begin(), list.end(), [](const BroadphasePair &l, const BroadphasePair &r) {
+            return l.a != r.a ? l.a < r.a : l.b < r.b;
+        });
+    };
+    canonical(pairs);
+    canonical(brute_pairs);
+    bool is_same = pairs.size() == brute_pairs.size();
+    for (usize i = 0; is_same && i < pairs.size(); i++) {
+        is_same = pairs[i].a == brute_pairs[i].a && pairs[i].b == brute_pairs[i].b;
+    }
+
+    // Everything moves a bit, most stay in their cells
+    for (GoData &go : gos) {
+        go.transform.translate_xy(Vec2(rng.range(-0.1f, 0.1f), rng.range(-0.1f, 0.1f)));
+    }
+    start = devtool_now_ms();
+    broadphase.update_all();
+    const double update_ms = devtool_now_ms() - start;
+
+    printf("%u objects, %zu overlapping pairs\n", count, pairs.size());
+    printf("add all %.2f ms, update_all with everything moving %.2f ms\n", add_ms, update_ms);
+    printf("pairs: spatial hash %.2f ms, brute force %.2f ms (%.1fx). %s\n", hash_ms, brute_ms,
+           brute_ms / hash_ms, is_same ? "same pairs" : "PAIRS DIFFER");
+    return is_same ? 0 : 1;
+}
+
+// What Mat4 * Mat4 would be without SSE, column major like Mat4
+static Mat4 devtool_mat4_mul_scalar(const Mat4 &a, const Mat4 &b) {
+    Mat4 result;
+    for (u32 col = 0; col < 4; col++) {
+        for (u32 row = 0; row < 4; row++) {
+            f32 sum = 0.0f;
+            for (u32 k = 0; k < 4; k++) {
+                sum += a.data[k * 4 + row] * b.data[col * 4 + k];
+            }
+            result.data[col * 4 + row] = sum;
+        }
+    }
+    return result;
+}
+
+// The SSE Mat4 multiply and transform_points_xy against scalar loops over the same inputs
+static int bench_math(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    const u32 matrix_count = 4096;
+    const u32 matrix_iteration_count = 200;
+    const usize point_count = 1 << 20;
+    const u32 point_iteration_count = 100;
+
+    Rng rng(5);
+    std::vector<Mat4> lhs(matrix_count);
+    std::vector<Mat4> rhs(matrix_count);
+    for (u32 i = 0; i < matrix_count; i++) {
+        for (u32 j = 0; j < 16; j++) {
+            lhs[i].data[j] = rng.range(-1.0f, 1.0f);
+            rhs[i].data[j] = rng.range(-1.0f, 1.0f);
+        }
+    }
+    std::vector<Mat4> scalar_products(matrix_count);
+    std::vector<Mat4> sse_products(matrix_count);
+
+    double start = devtool_now_ms();
+    for (u32 iteration = 0; iteration < matrix_iteration_count; iteration++) {
+        for (u32 i = 0; i < matrix_count; i++) {
+            scalar_products[i] = devtool_mat4_mul_scalar(lhs[i], rhs[(i + iteration) % matrix_count]);
+        }
+    }
+    const double scalar_mul_ms = (devtool_now_ms() - start) / matrix_iteration_count;
+
+    start = devtool_now_ms();
+    for (u32 iteration = 0; iteration < matrix_iteration_count; iteration++) {
+        for (u32 i = 0; i < matrix_count; i++) {
+            sse_products[i] = lhs[i] * rhs[(i + iteration) % matrix_count];
+        }
+    }
+    const double sse_mul_ms = (devtool_now_ms() - start) / matrix_iteration_count;
+
+    // Same sums in a different order, so not bit exact. Also keeps the loops from being thrown away
+    f32 max_mul_diff = 0.0f;
+    for (u32 i = 0; i < matrix_count; i++) {
+        for (u32 j = 0; j < 16; j++) {
+            const f32 diff = fabsf(scalar_products[i].data[j] - sse_products[i].data[j]);
+            max_mul_diff = diff > max_mul_diff ? diff : max_mul_diff;
+        }
+    }
+
+    Mat4 m = Mat4::identity();
+    m.set_scale_xy(Vec2(2.0f, 0.5f));
+    m.translate_xy(Vec2(3.0f, -1.0f));
+    std::vector<f32> in_x(point_count);
+    std::vector<f32> in_y(point_count);
+    for (usize i = 0; i < point_count; i++) {
+        in_x[i] = rng.range(-10.0f, 10.0f);
+        in_y[i] = rng.range(-10.0f, 10.0f);
+    }
+    std::vector<Vec2> scalar_points(point_count);
+    std::vector<f32> out_x(point_count);
+    std::vector<f32> out_y(point_count);
+
+    start = devtool_now_ms();
+    for (u32 iteration = 0; iteration < point_iteration_count; iteration++) {
+        for (usize i = 0; i < point_count; i++) {
+            scalar_points[i] = m.transform_point_xy(Vec2(in_x[i], in_y[i]));
+        }
+    }
+    const double scalar_points_ms = (devtool_now_ms() - start) / point_iteration_count;
+
+    start = devtool_now_ms();
+    for (u32 iteration = 0; iteration < point_iteration_count; iteration++) {
+        transform_points_xy(m, in_x.data(), in_y.data(), out_x.data(), out_y.data(), point_count);
+    }
+    const double sse_points_ms = (devtool_now_ms() - start) / point_iteration_count;
+
+    f32 max_point_diff = 0.0f;
+    for (usize i = 0; i < point_count; i++) {
+        const f32 diff = fabsf(scalar_points[i].x - out_x[i]) + fabsf(scalar_points[i].y - out_y[i]);
+        max_point_diff = diff > max_point_diff ? diff : max_point_diff;
+    }
+
+    printf("%u Mat4 multiplies, ms per pass. scalar: %.3f, sse: %.3f (%.2fx). max diff %g\n", matrix_count,
+           scalar_mul_ms, sse_mul_ms, scalar_mul_ms / sse_mul_ms, max_mul_diff);
+    printf("%zu points transformed, ms per pass. scalar: %.3f, sse: %.3f (%.2fx). max diff %g\n", point_count,
+           scalar_points_ms, sse_points_ms, scalar_points_ms / sse_points_ms, max_point_diff);
+    return 0;
+}
+
+static bool devtool_near(Vec2 a, Vec2 b) {
+    return fabsf(a.x - b.x) < 1e-4f && fabsf(a.y - b.y) < 1e-4f;
+}
+
+// Where a unit quad's corner ends up, so scale shows up too, not just the position
+static Vec2 devtool_corner(const Mat4 &transform) {
+    return transform.transform_point_xy(Vec2(0.5f, 0.5f));
+}
+
+static int test_transform(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    u32 failure_count = 0;
+
+    // Translated and scaled parent, size is scale for a GoData
+    GoData parent(Vec2(3.0f, 2.0f), Vec2(2.0f, 4.0f));
+    GoData child(Vec2(5.0f, -1.0f), Vec2(0.5f, 0.5f));
+    GoData grandchild(Vec2(-2.0f, 7.0f), Vec2(1.0f, 3.0f));
+    const Vec2 child_pos = child.transform.get_pos_xy();
+    const Vec2 child_corner = devtool_corner(child.transform);
+    const Vec2 grandchild_corner = devtool_corner(grandchild.transform);
+
+    TransformHierarchy transforms;
+    const u32 parent_handle = transforms.add_root(parent);
+    const u32 child_handle = transforms.add_child(child, parent_handle);
+    transforms.add_child(grandchild, child_handle);
+    transforms.update();
+
+    // Attaching doesn't move anything
+    DEVTOOL_CHECK(failure_count, devtool_near(child.transform.get_pos_xy(), child_pos));
+    DEVTOOL_CHECK(failure_count, devtool_near(devtool_corner(child.transform), child_corner));
+    DEVTOOL_CHECK(failure_count, devtool_near(devtool_corner(grandchild.transform), grandchild_corner));
+
+    // Then they follow the parent
+    parent.transform.translate_xy(Vec2(1.0f, -1.0f));
+    transforms.update();
+    DEVTOOL_CHECK(failure_count, devtool_near(child.transform.get_pos_xy(), child_pos + Vec2(1.0f, -1.0f)));
+    DEVTOOL_CHECK(failure_count,
+                  devtool_near(devtool_corner(grandchild.transform), grandchild_corner + Vec2(1.0f, -1.0f)));
+
+    // And the inverse itself
+    Mat4 m = Mat4::identity();
+    m.set_scale_xy(Vec2(2.0f, -3.0f));
+    m.translate_xy(Vec2(4.0f, 5.0f));
+    const Mat4 round_trip = m * m.inverse_affine();
+    for (u32 i = 0; i < 16; i++) {
+        DEVTOOL_CHECK(failure_count, fabsf(round_trip.data[i] - Mat4::identity().data[i]) < 1e-5f);
+    }
+
+    return devtool_report("transform", failure_count);
+}
+
+static i32 devtool_peak(const WavInfo &wav) {
+    i32 peak = 0;
+    for (u32 i = 0; i < wav.data_size / 2; i++) {
+        i16 sample;
+        memcpy(&sample, wav.data + i * 2, sizeof(sample)); // Not aligned in the file
+        peak = abs(sample) > peak ? abs(sample) : peak;
+    }
+    return peak;
+}
+
+// One sound through the WAV output, driven with game frames the way the loop does it
+static int test_mixer(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    const char *sound_file_name = "assets/HitPad.Wav";
+    const char *out_file_name = "test_mixer.wav";
+    u32 failure_count = 0;
+
+    MappedFile sound_file = Util::map_file(sound_file_name);
+    WavInfo sound_wav;
+    if (!sound_file.data || !wav_parse(sound_file.data, sound_file.size, sound_wav) ||
+        sound_wav.bits_per_sample != 16) {
+        printf("Can't read %s\n", sound_file_name);
+        return 1;
+    }
+    const u32 sound_frame_count = sound_wav.frame_count;
+    const i32 sound_peak = devtool_peak(sound_wav);
+    Util::unmap_file(sound_file);
+
+    {
+        SfxSettings settings;
+        settings.output = SfxOutput::MixerWav;
+        settings.wav_file_name = out_file_name;
+        std::vector<SfxAsset> assets;
+        assets.emplace_back(SfxId::SfxHitPad, sound_file_name);
+
+        Sfx sfx(assets, settings);
+        sfx.play(SfxId::SfxHitPad);
+        for (u32 frame = 0; frame < 60; frame++) {
+            sfx.advance(1.0f / 60.0f);
+        }
+    } // The audio thread renders what's left in the ring and the header gets written
+
+    MappedFile out_file = Util::map_file(out_file_name);
+    WavInfo out_wav;
+    const bool is_parsed = out_file.data && wav_parse(out_file.data, out_file.size, out_wav);
+    DEVTOOL_CHECK(failure_count, is_parsed);
+    if (is_parsed) {
+        // A second of game time, and the sound at its gain, panned to the center
+        const f32 center_gain = SFX_DEFAULT_GAIN * cosf(0.25f * 3.14159265f);
+        const i32 expected_peak = (i32)lrintf((f32)sound_peak * center_gain);
+        const i32 peak = devtool_peak(out_wav);
+        DEVTOOL_CHECK(failure_count, out_wav.channel_count == MIXER_CHANNEL_COUNT);
+        DEVTOOL_CHECK(failure_count, out_wav.sample_freq == MIXER_SAMPLE_RATE);
+        DEVTOOL_CHECK(failure_count, out_wav.frame_count == MIXER_SAMPLE_RATE);
+        DEVTOOL_CHECK(failure_count, sound_peak > 0 && abs(peak - expected_peak) <= 1);
+
+        // Silent after the sound ended
+        WavInfo tail = out_wav;
+        const u32 sound_bytes = sound_frame_count * MIXER_CHANNEL_COUNT * (u32)sizeof(i16);
+        tail.data += sound_bytes < tail.data_size ? sound_bytes : tail.data_size;
+        tail.data_size -= sound_bytes < tail.data_size ? sound_bytes : tail.data_size;
+        DEVTOOL_CHECK(failure_count, devtool_peak(tail) == 0);
+        printf("%u frames, peak %d, expected %d\n", out_wav.frame_count, peak, expected_peak);
+    }
+    if (out_file.data) {
+        Util::unmap_file(out_file);
+    }
+    remove(out_file_name);
+
+    // A path that can't be written mixes into nothing, instead of taking the audio thread down
+    {
+        SfxSettings settings;
+        settings.output = SfxOutput::MixerWav;
+        settings.wav_file_name = "no_such_dir/test_mixer.wav";
+        std::vector<SfxAsset> assets;
+        assets.emplace_back(SfxId::SfxHitPad, sound_file_name);
+
+        Sfx sfx(assets, settings);
+        sfx.play(SfxId::SfxHitPad);
+        sfx.advance(0.1f);
+    }
+
+    return devtool_report("mixer", failure_count);
+}
+
+// Mixing cost as voices are added, into the null sink the way a headless run does it. Optional argument:
+// seconds of audio per voice count, 10 by default
+static int bench_mixer(int argc, char **argv) {
+    const u32 seconds = argc >= 1 ? (u32)atoi(argv[0]) : 10;
+    if (seconds == 0) {
+        printf("Need at least a second\n");
+        return 1;
+    }
+    const u32 frame_count = seconds * MIXER_SAMPLE_RATE;
+    const u32 block_count = (frame_count + MIXER_BLOCK_FRAMES - 1) / MIXER_BLOCK_FRAMES;
+
+    // Mono noise as long as the render, so every voice stays active to the end
+    Rng rng(9);
+    std::vector<i16> samples(frame_count);
+    for (i16 &sample : samples) {
+        sample = (i16)rng.range(-8000.0f, 8000.0f);
+    }
+    const MixerSound sound((const u8 *)samples.data(), frame_count * (u32)sizeof(i16), 1, 16);
+
+    const u32 voice_counts[] = {1, 8, MIXER_VOICE_COUNT};
+    for (u32 voice_count : voice_counts) {
+        Mixer mixer;
+        for (u32 i = 0; i < voice_count; i++) {
+            mixer.play(sound, 0.1f, rng.range(-1.0f, 1.0f));
+        }
+
+        MixerNullSink sink;
+        const double start = devtool_now_ms();
+        mixer.render(sink, frame_count);
+        const double render_ms = devtool_now_ms() - start;
+
+        const double block_us = render_ms * 1000.0 / block_count;
+        printf("%2u voices: %.2f ms for %llu frames, %.2f us per block, %.3f us per voice per block\n",
+               voice_count, render_ms, (unsigned long long)sink.frames_written, block_us,
+               block_us / voice_count);
+    }
+    return 0;
+}
+
+// Decode time and memory of ADPCM against the PCM it replaces. PCM files are encoded in memory first, the way
+// --encode-adpcm would write them
+static int bench_adpcm(int argc, char **argv) {
+    const char *shipped_file_names[] = {"assets/Start.Wav", "assets/HitPad.Wav", "assets/HitWall.Wav",
+                                        "assets/GameOver.Wav"};
+    const char *const *file_names = argc > 0 ? argv : shipped_file_names;
+    const int file_count = argc > 0 ? argc : (int)(sizeof(shipped_file_names) / sizeof(*shipped_file_names));
+    constexpr u32 run_count = 200;
+
+    u64 total_pcm_bytes = 0;
+    u64 total_adpcm_bytes = 0;
+    u64 total_frames = 0;
+    double total_ms = 0.0;
+    for (int file_index = 0; file_index < file_count; file_index++) {
+        const char *file_name = file_names[file_index];
+        MappedFile file = Util::map_file(file_name);
+        WavInfo wav;
+        if (!file.data || !wav_parse(file.data, file.size, wav)) {
+            printf("Can't read %s\n", file_name);
+            if (file.data) {
+                Util::unmap_file(file);
+            }
+            return 1;
+        }
+
+        std::vector<u8> encoded;
+        const u8 *blocks = wav.data;
+        u32 block_bytes = wav.data_size;
+        u16 block_align = wav.block_align;
+        if (wav.audio_format != WAV_FORMAT_IMA_ADPCM) {
+            const MixerSound pcm(wav.data, wav.data_size, wav.channel_count, wav.bits_per_sample);
+            encoded = adpcm_encode(pcm.samples.data(), pcm.frame_count, pcm.channel_count);
+            blocks = encoded.data();
+            block_bytes = (u32)encoded.size();
+            block_align = (u16)(ADPCM_BLOCK_BYTES_PER_CHANNEL * wav.channel_count);
+        }
+
+        const u32 block_count = block_bytes / block_align;
+        const u32 frames_per_block = adpcm_frames_per_block(block_align, wav.channel_count);
+        std::vector<i16> decoded((usize)block_count * frames_per_block * wav.channel_count);
+        const double start = devtool_now_ms();
+        for (u32 run = 0; run < run_count; run++) {
+            adpcm_decode(blocks, block_count, block_align, wav.channel_count, decoded.data());
+        }
+        const double decode_ms = (devtool_now_ms() - start) / run_count;
+
+        const u64 pcm_bytes = (u64)wav.frame_count * wav.channel_count * sizeof(i16);
+        printf("%s: %u frames, PCM %llu bytes, ADPCM %u bytes (%.2fx smaller), decode %.3f ms\n", file_name,
+               wav.frame_count, (unsigned long long)pcm_bytes, block_bytes, (double)pcm_bytes / block_bytes,
+               decode_ms);
+        total_pcm_bytes += pcm_bytes;
+        total_adpcm_bytes += block_bytes;
+        total_frames += wav.frame_count;
+        total_ms += decode_ms;
+        Util::unmap_file(file);
+    }
+
+    printf("all: PCM %llu bytes, ADPCM %llu bytes, %llu saved. Decode %.3f ms, %.1f Mframes/s\n",
+           (unsigned long long)total_pcm_bytes, (unsigned long long)total_adpcm_bytes,
+           (unsigned long long)(total_pcm_bytes - total_adpcm_bytes), total_ms,
+           (double)total_frames / (total_ms * 1000.0));
+    return 0;
+}
+
+// An emitter never keeps more than props.capacity alive, whatever the SIMD padding of its arrays
+static int test_emitter(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    u32 failure_count = 0;
+
+    ParticleEmitterProps props = {};
+    props.angle_limits = Vec2(0.0f, 360.0f);
+    props.lifetime_limits = Vec2(100.0f, 100.0f); // Nothing dies on its own in this test
+    props.spawn_rate = 600.0f;
+    props.speed = 1.0f;
+    props.capacity = 5; // Not a multiple of PARTICLE_SIMD_WIDTH
+    ParticleEmitter emitter(props, Vec2::zero(), 1);
+
+    for (u32 frame = 0; frame < 60; frame++) {
+        emitter.update(1.0f / 60.0f);
+        DEVTOOL_CHECK(failure_count, emitter.live_count <= props.capacity);
+    }
+    DEVTOOL_CHECK(failure_count, emitter.live_count == props.capacity);
+    for (u32 i = 0; i < emitter.live_count; i++) {
+        DEVTOOL_CHECK(failure_count, emitter.slot(i) < props.capacity);
+    }
+
+    return devtool_report("emitter", failure_count);
+}
+
+static const DevTool devtools[] = {
+    {"--bench-particles", bench_particles, "SoA SIMD particle update against the AoS loop"},
+    {"--test-collision", test_collision, "Swept AABB, SIMD against scalar"},
+    {"--test-emitter", test_emitter, "Emitters stay within their capacity"},
+    {"--test-transform", test_transform, "Attaching children keeps them in place"},
+    {"--test-mixer", test_mixer, "One sfx rendered to WAV through the headless output"},
+    {"--bench-math", bench_math, "SSE Mat4 multiply and batch point transform against scalar loops"},
+    {"--bench-mixer", bench_mixer, "Mixing cost per voice for 1, 8 and all voices. [seconds]"},
+    {"--bench-adpcm", bench_adpcm, "ADPCM decode time and bytes against PCM. [wav files], or the assets"},
+    {"--bench-broadphase", bench_broadphase, "Spatial hash pairs against brute force. [object count]"},
+};
+
+const DevTool *devtool_find(const char *flag) {
+    for (const DevTool &tool : devtools) {
+        if (strcmp(tool.flag, flag) == 0) {
+            return &tool;
+        }
+    }
+    return nullptr;
+}
@@ -5,11 +5,16 @@ Entity::Entity(const std::string &tag) : tag(tag) {
 }
 
 GameObject::GameObject(const std::string &tag, GoData data_, GoRenderUnit ru_)
-    : Entity(tag), data(std::move(data_)), ru(std::move(ru_)) {
+    : Entity(tag), data(std::move(data_)), ru(std::move(ru_)), broadphase_id(0),
+      transform_node(TRANSFORM_NO_PARENT) {
+}
+
+ParticleSystem::ParticleSystem(const std::string &tag, ParticleSource ps_, texture_handle texture)
+    : Entity(tag), ps(std::move(ps_)), texture(texture) {
 }
 
-ParticleSystem::ParticleSystem(const std::string &tag, ParticleSource ps_, ParticleRenderUnit ru_)
-    : Entity(tag), ps(std::move(ps_)), ru(std::move(ru_)) {
+Emitter::Emitter(const std::string &tag, ParticleEmitter emitter_, texture_handle texture)
+    : Entity(tag), emitter(std::move(emitter_)), texture(texture) {
 }
 
 Widget::Widget(const std::string &tag, WidgetData data_, WidgetRenderUnit ru_)
@@ -20,9 +25,11 @@ Scene::Scene(const std::string &name, std::function<std::optional<std::string>(f
     : name(name), update_func(update) {
 }
 
-Engine::Engine(u32 screen_width, u32 screen_height, f32 cam_size, std::vector<SfxAsset> sfx_assets)
-    : input(), sfx(sfx_assets), renderer(screen_width, screen_height, cam_size),
-      font_data("assets/Consolas.ttf") {
+Engine::Engine(u32 screen_width, u32 screen_height, f32 cam_size, std::vector<SfxAsset> sfx_assets, u64 seed,
+               const SfxSettings &sfx_settings)
+    : particle_budget(PARTICLE_BUDGET_DEFAULT), input(), sfx(sfx_assets, sfx_settings), seed(seed), rng(seed),
+      renderer(screen_width, screen_height, cam_size), font_data("assets/Consolas.ttf"), broadphase(),
+      transforms() {
 }
 
 GameObject &Engine::get_go(const std::string &tag) const {
@@ -58,6 +65,22 @@ const RenderInfo &Engine::get_render_info() const {
     return renderer.render_info;
 }
 
+Broadphase &Engine::get_broadphase() {
+    return broadphase;
+}
+
+TransformHierarchy &Engine::get_transforms() {
+    return transforms;
+}
+
+Rng &Engine::get_rng() {
+    return rng;
+}
+
+u64 Engine::get_seed() const {
+    return seed;
+}
+
 void Engine::register_particle_prop(ParticleSystemType type, const ParticleProps &props) {
     if (particle_props.find(type) != particle_props.end()) {
         printf("Trying to re-register the particle type: %d\n", type);
@@ -70,20 +93,69 @@ void Engine::register_particle_prop(ParticleSystemType type, const ParticleProps
 void Engine::register_particle(const std::string &state_name, ParticleSystemType type, Vec2 emit_point) {
     const ParticleProps &props = particle_props[type];
 
-    std::shared_ptr<ParticleSystem> ps = std::make_shared<ParticleSystem>(
-        "particle", ParticleSource(props, emit_point),
-        ParticleRenderUnit(props.count, renderer.render_info, "assets/Ball.png"));
+    std::shared_ptr<ParticleSystem> ps =
+        std::make_shared<ParticleSystem>("particle", ParticleSource(props, emit_point, rng.next_seed()),
+                                         renderer.particle_batch->get_texture("assets/Ball.png"));
 
     particles.push_back(ps);
     get_scene(state_name).state_particles.push_back(ps);
 }
 
-// We might want to have a deregister_particle(ParticleSystem&) overload here in the future.
-// That will require the == operator's overload
 void Engine::deregister_particle(usize index) {
     particles.erase(particles.begin() + (i64)index);
 }
 
+void Engine::deregister_particle(const ParticleSystem &ps) {
+    for (usize i = 0; i < particles.size(); i++) {
+        if (particles[i].get() == &ps) {
+            deregister_particle(i);
+            return;
+        }
+    }
+}
+
+void Engine::register_emitter(const std::string &tag, const std::string &state_name,
+                              const ParticleEmitterProps &props, Vec2 emit_point) {
+    std::shared_ptr<Emitter> emitter_ptr =
+        std::make_shared<Emitter>(tag, ParticleEmitter(props, emit_point, rng.next_seed()),
+                                  renderer.particle_batch->get_texture("assets/Ball.png"));
+
+    emitters.push_back(emitter_ptr);
+    get_scene(state_name).state_emitters.push_back(emitter_ptr);
+}
+
+Emitter &Engine::get_emitter(const std::string &tag) const {
+    for (auto emitter : emitters) {
+        if (emitter->tag == tag) {
+            return *emitter;
+        }
+    }
+    UNREACHABLE("Emitter not found");
+}
+
+void Engine::set_particle_budget(u32 budget) {
+    particle_budget = budget;
+}
+
+void Engine::enforce_particle_budget() {
+    u32 live_total = 0;
+    for (auto emitter : emitters) {
+        live_total += emitter->emitter.live_count;
+    }
+    if (live_total <= particle_budget) {
+        return;
+    }
+
+    // Every emitter gives up its oldest ones, in proportion to how many it has. Rounded up so that we always
+    // end up within the budget
+    const u32 excess = live_total - particle_budget;
+    for (auto emitter : emitters) {
+        const u64 live_count = emitter->emitter.live_count;
+        const u32 shed_count = (u32)((live_count * excess + live_total - 1) / live_total);
+        emitter->emitter.shed_oldest(shed_count);
+    }
+}
+
 void Engine::register_gameobject(const std::string &tag, const std::string &state_name, Vec2 pos, Vec2 size,
                                  char *texture_path) {
 
@@ -96,6 +168,7 @@ void Engine::register_gameobject(const std::string &tag, const std::string &stat
         GoRenderUnit(unit_square_verts, sizeof(unit_square_verts), unit_square_indices,
                      sizeof(unit_square_indices), renderer.world_shader, texture_path));
 
+    go_ptr->broadphase_id = broadphase.add(go_ptr->data);
     game_objects.push_back(go_ptr);
 
     for (Scene &state : all_scenes) {
@@ -106,12 +179,23 @@ void Engine::register_gameobject(const std::string &tag, const std::string &stat
     }
 }
 
+void Engine::attach_gameobject(const std::string &child_tag, const std::string &parent_tag) {
+    GameObject &child = get_go(child_tag);
+    GameObject &parent = get_go(parent_tag);
+    assert(child.transform_node == TRANSFORM_NO_PARENT);
+
+    if (parent.transform_node == TRANSFORM_NO_PARENT) {
+        parent.transform_node = (i32)transforms.add_root(parent.data);
+    }
+    child.transform_node = (i32)transforms.add_child(child.data, (u32)parent.transform_node);
+}
+
 void Engine::register_ui_entity(const std::string &tag, const std::string &state_name,
                                 const std::string &text, TextTransform transform) {
     WidgetData widget(text, transform, font_data); // It's fine if this is destroyed at the scope end
 
     std::shared_ptr<Widget> widget_ptr =
-        std::make_shared<Widget>(tag, widget, WidgetRenderUnit(renderer.ui_shader, widget));
+        std::make_shared<Widget>(tag, widget, WidgetRenderUnit(widget));
 
     ui.push_back(widget_ptr);
 
@@ -132,8 +216,54 @@ void Engine::sfx_play(SfxId id) {
     sfx.play(id);
 }
 
+void Engine::sfx_dump_latency() {
+    sfx.dump_latency();
+}
+
+sfx_stream_handle Engine::sfx_stream_open(const std::string &file_name, bool is_looping) {
+    return sfx.stream_open(file_name, is_looping);
+}
+
+void Engine::sfx_stream_play(sfx_stream_handle stream) {
+    sfx.stream_play(stream);
+}
+
+void Engine::sfx_stream_stop(sfx_stream_handle stream) {
+    sfx.stream_stop(stream);
+}
+
 void Engine::particle_play(const std::string &state_name, ParticleSystemType type, Vec2 collision_point) {
-    register_particle(state_name, type, collision_point);
+    const ParticleProps &props = particle_props[type];
+    if (props.sim_mode == ParticleSimMode::Cpu) {
+        register_particle(state_name, type, collision_point);
+        return;
+    }
+
+    // GPU particles of a type share one system, created on the first play and drawn with that scene
+    if (props.sim_mode == ParticleSimMode::Analytic) {
+        auto it = analytic_particles.find(type);
+        if (it == analytic_particles.end()) {
+            std::shared_ptr<AnalyticParticleSystem> system = std::make_shared<AnalyticParticleSystem>(
+                props.gpu_capacity, props.size, renderer.particle_batch->get_texture("assets/Ball.png"),
+                renderer.particle_analytic_shader, rng.next_seed());
+            get_scene(state_name).state_analytic_particles.push_back(system);
+            it = analytic_particles.insert(std::make_pair(type, system)).first;
+        }
+
+        it->second->emit_burst(props, collision_point);
+        return;
+    }
+
+    auto it = gpu_particles.find(type);
+    if (it == gpu_particles.end()) {
+        std::shared_ptr<GpuParticleSystem> system = std::make_shared<GpuParticleSystem>(
+            props.gpu_capacity, props.size, renderer.particle_batch->get_texture("assets/Ball.png"),
+            renderer.particle_sim_shader, renderer.particle_gpu_shader, rng.next_seed());
+        get_scene(state_name).state_gpu_particles.push_back(system);
+        it = gpu_particles.insert(std::make_pair(type, system)).first;
+    }
+
+    it->second->emit_burst(props, collision_point);
 }
 
 bool Engine::input_just_pressed(KeyCode key_code) const {
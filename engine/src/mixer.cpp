@@ -0,0 +1,204 @@
+#include "common.h"
+
+DISABLE_WARNINGS
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+ENABLE_WARNINGS
+
+#include "mixer.h"
+
+MixerSound::MixerSound(const u8 *pcm, u32 byte_count, u16 channel_count, u16 bits_per_sample)
+    : channel_count(channel_count) {
+    if (bits_per_sample == 8) {
+        // Unsigned 8 bit, centered at 128
+        samples.resize(byte_count);
+        for (u32 i = 0; i < byte_count; i++) {
+            samples[i] = (i16)(((i32)pcm[i] - 128) << 8);
+        }
+    } else {
+        samples.resize(byte_count / 2);
+        memcpy(samples.data(), pcm, samples.size() * sizeof(i16));
+    }
+    frame_count = (u32)(samples.size() / channel_count);
+}
+
+void MixerNullSink::write(const i16 *frames, u32 frame_count) {
+    (void)frames;
+    frames_written += frame_count;
+}
+
+MixerWavSink::MixerWavSink(const char *file_path) : data_size(0) {
+    file = fopen(file_path, "wb");
+    if (!file) {
+        printf("Can't open %s for writing, the mix is thrown away\n", file_path);
+        return; // Then it's a null sink
+    }
+
+    // Placeholder, the sizes are written at the end
+    u8 header[44] = {};
+    fwrite(header, 1, sizeof(header), file);
+}
+
+MixerWavSink::~MixerWavSink() {
+    if (!file) {
+        return;
+    }
+
+    const u32 block_align = MIXER_CHANNEL_COUNT * sizeof(i16);
+    const u32 byte_rate = MIXER_SAMPLE_RATE * block_align;
+    const u32 riff_size = 36 + data_size;
+    const u32 fmt_size = 16;
+    const u16 audio_format = 1; // PCM
+    const u16 channel_count = MIXER_CHANNEL_COUNT;
+    const u32 sample_rate = MIXER_SAMPLE_RATE;
+    const u16 block_align_u16 = (u16)block_align;
+    const u16 bits_per_sample = 16;
+
+    fseek(file, 0, SEEK_SET);
+    fwrite("RIFF", 1, 4, file);
+    fwrite(&riff_size, 4, 1, file);
+    fwrite("WAVEfmt ", 1, 8, file);
+    fwrite(&fmt_size, 4, 1, file);
+    fwrite(&audio_format, 2, 1, file);
+    fwrite(&channel_count, 2, 1, file);
+    fwrite(&sample_rate, 4, 1, file);
+    fwrite(&byte_rate, 4, 1, file);
+    fwrite(&block_align_u16, 2, 1, file);
+    fwrite(&bits_per_sample, 2, 1, file);
+    fwrite("data", 1, 4, file);
+    fwrite(&data_size, 4, 1, file);
+    fclose(file);
+}
+
+void MixerWavSink::write(const i16 *frames, u32 frame_count) {
+    if (!file) {
+        return;
+    }
+    const u32 byte_count = frame_count * MIXER_CHANNEL_COUNT * sizeof(i16);
+    fwrite(frames, 1, byte_count, file);
+    data_size += byte_count;
+}
+
+Mixer::Mixer()
+    : play_count(0), accumulator(MIXER_BLOCK_FRAMES * MIXER_CHANNEL_COUNT),
+      block(MIXER_BLOCK_FRAMES * MIXER_CHANNEL_COUNT) {
+    memset(voices, 0, sizeof(voices));
+}
+
+void Mixer::play(const MixerSound &sound, f32 gain, f32 pan) {
+    MixerVoice *voice = nullptr;
+    for (MixerVoice &candidate : voices) {
+        if (!candidate.is_active) {
+            voice = &candidate;
+            break;
+        }
+        if (voice == nullptr || candidate.start_order < voice->start_order) {
+            voice = &candidate; // Oldest so far, in case nothing is free
+        }
+    }
+
+    // Constant power, so a sound doesn't get quieter in the middle
+    const f32 angle = (pan + 1.0f) * 0.25f * 3.14159265f;
+    voice->sound = &sound;
+    voice->cursor = 0;
+    voice->gain_left = gain * cosf(angle);
+    voice->gain_right = gain * sinf(angle);
+    voice->start_order = play_count++;
+    voice->is_active = true;
+}
+
+void Mixer::mix_voice(MixerVoice &voice, u32 frame_count) {
+    const MixerSound &sound = *voice.sound;
+    u32 mix_count = sound.frame_count - voice.cursor;
+    mix_count = mix_count < frame_count ? mix_count : frame_count;
+
+    f32 *acc = accumulator.data();
+    const i16 *src = sound.samples.data() + (usize)voice.cursor * sound.channel_count;
+    u32 i = 0;
+
+    if (sound.channel_count == 1) {
+        const __m128 gain_left_4 = _mm_set1_ps(voice.gain_left);
+        const __m128 gain_right_4 = _mm_set1_ps(voice.gain_right);
+        for (; i + 4 <= mix_count; i += 4) {
+            // 4 mono samples to floats, then spread into LRLR LRLR
+            const __m128i s16 = _mm_loadl_epi64((const __m128i *)(src + i));
+            const __m128 s = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s16, s16), 16));
+            const __m128 left = _mm_mul_ps(s, gain_left_4);
+            const __m128 right = _mm_mul_ps(s, gain_right_4);
+            f32 *out = acc + i * 2;
+            _mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out), _mm_unpacklo_ps(left, right)));
+            _mm_storeu_ps(out + 4, _mm_add_ps(_mm_loadu_ps(out + 4), _mm_unpackhi_ps(left, right)));
+        }
+        for (; i < mix_count; i++) {
+            acc[i * 2] += (f32)src[i] * voice.gain_left;
+            acc[i * 2 + 1] += (f32)src[i] * voice.gain_right;
+        }
+    } else {
+        const __m128 gain_4 =
+            _mm_setr_ps(voice.gain_left, voice.gain_right, voice.gain_left, voice.gain_right);
+        for (; i + 2 <= mix_count; i += 2) {
+            const __m128i s16 = _mm_loadl_epi64((const __m128i *)(src + i * 2));
+            const __m128 s = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s16, s16), 16));
+            f32 *out = acc + i * 2;
+            _mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out), _mm_mul_ps(s, gain_4)));
+        }
+        for (; i < mix_count; i++) {
+            acc[i * 2] += (f32)src[i * 2] * voice.gain_left;
+            acc[i * 2 + 1] += (f32)src[i * 2 + 1] * voice.gain_right;
+        }
+    }
+
+    voice.cursor += mix_count;
+    voice.is_active = voice.cursor < sound.frame_count;
+}
+
+void Mixer::mix(i16 *out_frames, u32 frame_count) {
+    assert(frame_count <= MIXER_BLOCK_FRAMES);
+    const u32 sample_count = frame_count * MIXER_CHANNEL_COUNT;
+    memset(accumulator.data(), 0, sample_count * sizeof(f32));
+
+    for (MixerVoice &voice : voices) {
+        if (voice.is_active) {
+            mix_voice(voice, frame_count);
+        }
+    }
+
+    // Back to 16 bit. The pack saturates, so loud mixes clip instead of wrapping around
+    u32 i = 0;
+    for (; i + 8 <= sample_count; i += 8) {
+        const __m128i lo = _mm_cvtps_epi32(_mm_loadu_ps(accumulator.data() + i));
+        const __m128i hi = _mm_cvtps_epi32(_mm_loadu_ps(accumulator.data() + i + 4));
+        _mm_storeu_si128((__m128i *)(out_frames + i), _mm_packs_epi32(lo, hi));
+    }
+    for (; i < sample_count; i++) {
+        f32 sample = accumulator[i];
+        sample = sample > 32767.0f ? 32767.0f : (sample < -32768.0f ? -32768.0f : sample);
+        out_frames[i] = (i16)lrintf(sample);
+    }
+}
+
+void Mixer::service(IMixerSink &sink) {
+    for (u32 wanted = sink.blocks_wanted(); wanted > 0; wanted--) {
+        mix(block.data(), MIXER_BLOCK_FRAMES);
+        sink.write(block.data(), MIXER_BLOCK_FRAMES);
+    }
+}
+
+void Mixer::render(IMixerSink &sink, u32 frame_count) {
+    while (frame_count > 0) {
+        const u32 block_frames = frame_count < MIXER_BLOCK_FRAMES ? frame_count : MIXER_BLOCK_FRAMES;
+        mix(block.data(), block_frames);
+        sink.write(block.data(), block_frames);
+        frame_count -= block_frames;
+    }
+}
+
+u32 Mixer::get_active_voice_count() const {
+    u32 count = 0;
+    for (const MixerVoice &voice : voices) {
+        count += voice.is_active ? 1 : 0;
+    }
+    return count;
+}
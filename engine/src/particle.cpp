@@ -1,53 +1,181 @@
 #include <cstdlib>
 #include <cstring>
+#include <cmath>
+#include <immintrin.h>
 #include "common.h"
 #include "tomath.h"
 #include "particle.h"
 
-ParticleSource::ParticleSource(const ParticleProps &props, Vec2 emit_point)
-    : props(props), emit_point(emit_point) {
-    positions = new Vec2[props.count];
-    particles = new Particle[props.count];
+ParticleSource::ParticleSource(const ParticleProps &props, Vec2 emit_point, u64 seed)
+    : props(props), emit_point(emit_point), rng(seed) {
+    capacity = (props.count + PARTICLE_SIMD_WIDTH - 1) / PARTICLE_SIMD_WIDTH * PARTICLE_SIMD_WIDTH;
+
+    // One block for all four arrays. Each one is a multiple of 8 floats, so they all stay 32 byte aligned
+    pos_x = (f32 *)_mm_malloc(4 * capacity * sizeof(f32), 32);
+    pos_y = pos_x + capacity;
+    vel_x = pos_y + capacity;
+    vel_y = vel_x + capacity;
+    memset(pos_x, 0, 4 * capacity * sizeof(f32)); // Padding lanes just stand still
 
     life = 0;
 
     is_alive = true;
 
     for (u32 i = 0; i < props.count; i++) {
-        particles[i].index = i;
-        particles[i].angle = // Notice the "-1", we want the end angle to be inclusive
-            lerp(props.angle_limits.x, props.angle_limits.y, (f32)i / (f32)(props.count - 1));
+        Vec2 velocity = particle_emit_velocity(props, i, rng);
+        pos_x[i] = emit_point.x;
+        pos_y[i] = emit_point.y;
+        vel_x[i] = velocity.x;
+        vel_y[i] = velocity.y;
+    }
+}
 
-        particles[i].angle += rand_range(-props.angle_offset, props.angle_offset);
-        particles[i].speed_offset = props.speed * rand_range(-props.speed_offset, props.speed_offset);
+Vec2 particle_emit_velocity(const ParticleProps &props, u32 i, Rng &rng) {
+    f32 angle = // Notice the "-1", we want the end angle to be inclusive
+        lerp(props.angle_limits.x, props.angle_limits.y, (f32)i / (f32)(props.count - 1));
 
-        positions[i] = emit_point;
-    }
+    angle += rng.range(-props.angle_offset, props.angle_offset);
+    f32 speed = props.speed + props.speed * rng.range(-props.speed_offset, props.speed_offset);
+
+    return Vec2(cosf(angle * (f32)DEG2RAD) * speed, sinf(angle * (f32)DEG2RAD) * speed);
 }
 
 ParticleSource::ParticleSource(ParticleSource &&rhs)
-    : props(rhs.props), life(rhs.life), emit_point(rhs.emit_point), transparency(rhs.transparency),
-      is_alive(rhs.is_alive) {
-    positions = rhs.positions;
-    particles = rhs.particles;
-    rhs.positions = nullptr;
-    rhs.particles = nullptr;
+    : pos_x(rhs.pos_x), pos_y(rhs.pos_y), vel_x(rhs.vel_x), vel_y(rhs.vel_y), capacity(rhs.capacity),
+      props(rhs.props), life(rhs.life), emit_point(rhs.emit_point), transparency(rhs.transparency),
+      is_alive(rhs.is_alive), rng(rhs.rng) {
+    rhs.pos_x = nullptr;
+    rhs.pos_y = nullptr;
+    rhs.vel_x = nullptr;
+    rhs.vel_y = nullptr;
 }
 
 ParticleSource::~ParticleSource() {
-    delete positions;
-    delete particles;
+    _mm_free(pos_x); // Owns the whole block
 }
 
 void ParticleSource::update(f32 dt) {
-    for (u32 i = 0; i < props.count; i++) {
-        Vec2 dir = Vec2((f32)cos(particles[i].angle * DEG2RAD), (f32)sin(particles[i].angle * DEG2RAD));
-
-        f32 speed = props.speed + particles[i].speed_offset;
-        positions[i] = positions[i] + dir * (speed * dt);
-    }
+    particle_integrate(pos_x, pos_y, vel_x, vel_y, capacity, dt);
 
     life += dt;
     transparency = (props.lifetime - life) / props.lifetime;
     is_alive = life < props.lifetime;
-}
\ No newline at end of file
+}
+
+void particle_integrate(f32 *pos_x, f32 *pos_y, const f32 *vel_x, const f32 *vel_y, usize count, f32 dt) {
+#if defined(__AVX__)
+    const __m256 dt_8 = _mm256_set1_ps(dt);
+    for (usize i = 0; i < count; i += 8) {
+        __m256 x = _mm256_add_ps(_mm256_load_ps(pos_x + i), _mm256_mul_ps(_mm256_load_ps(vel_x + i), dt_8));
+        __m256 y = _mm256_add_ps(_mm256_load_ps(pos_y + i), _mm256_mul_ps(_mm256_load_ps(vel_y + i), dt_8));
+        _mm256_store_ps(pos_x + i, x);
+        _mm256_store_ps(pos_y + i, y);
+    }
+#else
+    // SSE is always there on x64. MSVC only defines __AVX__ with /arch:AVX
+    const __m128 dt_4 = _mm_set1_ps(dt);
+    for (usize i = 0; i < count; i += 4) {
+        __m128 x = _mm_add_ps(_mm_load_ps(pos_x + i), _mm_mul_ps(_mm_load_ps(vel_x + i), dt_4));
+        __m128 y = _mm_add_ps(_mm_load_ps(pos_y + i), _mm_mul_ps(_mm_load_ps(vel_y + i), dt_4));
+        _mm_store_ps(pos_x + i, x);
+        _mm_store_ps(pos_y + i, y);
+    }
+#endif
+}
+
+f32 ParticleCurve::evaluate(f32 t) const {
+    if (t <= 0.0f) {
+        return keys[0];
+    }
+    const f32 scaled = t * (f32)(PARTICLE_CURVE_KEY_COUNT - 1);
+    u32 key = (u32)scaled;
+    if (key >= PARTICLE_CURVE_KEY_COUNT - 1) {
+        return keys[PARTICLE_CURVE_KEY_COUNT - 1];
+    }
+    return lerp(keys[key], keys[key + 1], scaled - (f32)key);
+}
+
+ParticleEmitter::ParticleEmitter(const ParticleEmitterProps &props, Vec2 emit_point, u64 seed)
+    : oldest(0), live_count(0), spawn_accumulator(0.0f), props(props), emit_point(emit_point),
+      is_emitting(true), rng(seed) {
+    capacity = (props.capacity + PARTICLE_SIMD_WIDTH - 1) / PARTICLE_SIMD_WIDTH * PARTICLE_SIMD_WIDTH;
+
+    // Same as ParticleSource, one 32 byte aligned block for all the arrays
+    pos_x = (f32 *)_mm_malloc(6 * capacity * sizeof(f32), 32);
+    pos_y = pos_x + capacity;
+    vel_x = pos_y + capacity;
+    vel_y = vel_x + capacity;
+    age = vel_y + capacity;
+    lifetime = age + capacity;
+    memset(pos_x, 0, 6 * capacity * sizeof(f32));
+}
+
+ParticleEmitter::ParticleEmitter(ParticleEmitter &&rhs)
+    : pos_x(rhs.pos_x), pos_y(rhs.pos_y), vel_x(rhs.vel_x), vel_y(rhs.vel_y), age(rhs.age),
+      lifetime(rhs.lifetime), capacity(rhs.capacity), oldest(rhs.oldest), live_count(rhs.live_count),
+      spawn_accumulator(rhs.spawn_accumulator), props(rhs.props), emit_point(rhs.emit_point),
+      is_emitting(rhs.is_emitting), rng(rhs.rng) {
+    rhs.pos_x = nullptr;
+    rhs.pos_y = nullptr;
+    rhs.vel_x = nullptr;
+    rhs.vel_y = nullptr;
+    rhs.age = nullptr;
+    rhs.lifetime = nullptr;
+}
+
+ParticleEmitter::~ParticleEmitter() {
+    _mm_free(pos_x); // Owns the whole block
+}
+
+u32 ParticleEmitter::slot(u32 i) const {
+    // The ring is props.capacity, the padding past it only exists for the SIMD loops
+    u32 index = oldest + i;
+    return index < props.capacity ? index : index - (u32)props.capacity;
+}
+
+void ParticleEmitter::update(f32 dt) {
+    // Dead and unused slots get integrated too, it's cheaper than skipping them
+    particle_integrate(pos_x, pos_y, vel_x, vel_y, capacity, dt);
+    for (usize i = 0; i < capacity; i++) {
+        age[i] += dt;
+    }
+
+    while (live_count > 0 && age[oldest] >= lifetime[oldest]) {
+        shed_oldest(1);
+    }
+
+    if (!is_emitting) {
+        spawn_accumulator = 0.0f;
+        return;
+    }
+
+    spawn_accumulator += props.spawn_rate * dt;
+    while (spawn_accumulator >= 1.0f) {
+        spawn();
+        spawn_accumulator -= 1.0f;
+    }
+}
+
+void ParticleEmitter::shed_oldest(u32 count) {
+    count = count < live_count ? count : live_count;
+    oldest = slot(count);
+    live_count -= count;
+}
+
+void ParticleEmitter::spawn() {
+    if (live_count == props.capacity) {
+        shed_oldest(1); // Full, so the oldest one makes room
+    }
+
+    const u32 i = slot(live_count);
+    live_count++;
+
+    f32 angle = rng.range(props.angle_limits.x, props.angle_limits.y);
+    f32 speed = props.speed + props.speed * rng.range(-props.speed_offset, props.speed_offset);
+    pos_x[i] = emit_point.x;
+    pos_y[i] = emit_point.y;
+    vel_x[i] = cosf(angle * (f32)DEG2RAD) * speed;
+    vel_y[i] = sinf(angle * (f32)DEG2RAD) * speed;
+    age[i] = 0.0f;
+    lifetime[i] = rng.range(props.lifetime_limits.x, props.lifetime_limits.y);
+}
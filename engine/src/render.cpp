@@ -10,6 +10,8 @@ DISABLE_WARNINGS
 #include <cstdio>
 #include <cassert>
 #include <string>
+#include <vector>
+#include <algorithm>
 #include <GL/glew.h>
 ENABLE_WARNINGS
 
@@ -37,6 +39,12 @@ Renderer::Renderer(u32 screen_width, u32 screen_height, f32 cam_size) {
 
     ui_shader = std::make_unique<Shader>("engine/src/shader/ui.glsl");
     world_shader = std::make_unique<Shader>("engine/src/shader/world.glsl");
+    ui_batch = std::make_unique<UiBatch>();
+    particle_batch = std::make_unique<ParticleBatch>(render_info);
+    std::vector<const char *> sim_varyings = {"tf_pos", "tf_vel", "tf_age_life"};
+    particle_sim_shader = std::make_shared<Shader>("engine/src/shader/particle_sim.glsl", sim_varyings);
+    particle_gpu_shader = std::make_shared<Shader>("engine/src/shader/particle_gpu.glsl");
+    particle_analytic_shader = std::make_shared<Shader>("engine/src/shader/particle_analytic.glsl");
 
     glEnable(GL_BLEND); // Enabling transparency for texts
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -49,6 +57,11 @@ Renderer::Renderer(u32 screen_width, u32 screen_height, f32 cam_size) {
 
     world_shader->set_mat4("u_view", view);
     world_shader->set_mat4("u_proj", proj);
+    ui_shader->set_int("u_texture_ui", 0);
+    particle_gpu_shader->set_mat4("u_view", view);
+    particle_gpu_shader->set_mat4("u_proj", proj);
+    particle_analytic_shader->set_mat4("u_view", view);
+    particle_analytic_shader->set_mat4("u_proj", proj);
 }
 
 void Renderer::begin_frame() {
@@ -57,17 +70,19 @@ void Renderer::begin_frame() {
     glClear(GL_COLOR_BUFFER_BIT);
 }
 
+void Renderer::draw_ui(const std::vector<WidgetRenderUnit *> &units) {
+    ui_batch->draw(units, *ui_shader);
+}
+
+void Renderer::draw_particles(std::vector<ParticleBatchItem> &items) {
+    particle_batch->draw(items);
+}
+
 //
 // Font data
 //
-FontData::FontData(const std::string &ttf_path) {
-    u8 *font_bytes = (u8 *)Util::read_file(ttf_path.c_str());
-    assert(font_bytes != nullptr);
-    font_bitmap = new u8[FONT_ATLAS_WIDTH * FONT_ATLAS_HEIGHT];
-
-    stbtt_BakeFontBitmap((u8 *)font_bytes, 0, FONT_TEXT_HEIGHT, font_bitmap, FONT_ATLAS_WIDTH,
-                         FONT_ATLAS_HEIGHT, ' ', CHAR_COUNT, font_char_data.data());
-
+static void font_bake_atlas(const u8 *font_bytes, u8 *out_bitmap, stbtt_bakedchar *out_char_data,
+                            f32 *out_ascent, f32 *out_descent) {
     stbtt_fontinfo font_info;
     stbtt_InitFont(&font_info, font_bytes, 0);
 
@@ -75,26 +90,377 @@ FontData::FontData(const std::string &ttf_path) {
     stbtt_GetFontVMetrics(&font_info, &ascent_int, &descent_int, &line_gap);
 
     f32 scale = stbtt_ScaleForPixelHeight(&font_info, FONT_TEXT_HEIGHT);
-    ascent = (f32)ascent_int * scale;
-    descent = (f32)descent_int * scale;
+    *out_ascent = (f32)ascent_int * scale;
+    *out_descent = (f32)descent_int * scale;
+
+    memset(out_bitmap, 0, FONT_ATLAS_WIDTH * FONT_ATLAS_HEIGHT);
+
+    // Same packing as stbtt_BakeFontBitmap: left to right, a new row when the current one is full. We fill
+    // the same bakedchar entries too, so the quads still come from stbtt_GetBakedQuad
+    const f32 pixel_dist_scale = (f32)FONT_SDF_ONEDGE / (f32)FONT_SDF_PADDING;
+    i32 pen_x = 1, pen_y = 1, row_height = 0;
+    for (i32 i = 0; i < CHAR_COUNT; i++) {
+        const i32 codepoint = ' ' + i;
+        i32 advance, left_side_bearing;
+        stbtt_GetCodepointHMetrics(&font_info, codepoint, &advance, &left_side_bearing);
+
+        // Glyphs without a shape (space) come back as null with zero size
+        i32 glyph_width = 0, glyph_height = 0, x_offset = 0, y_offset = 0;
+        u8 *sdf = stbtt_GetCodepointSDF(&font_info, scale, codepoint, FONT_SDF_PADDING, FONT_SDF_ONEDGE,
+                                        pixel_dist_scale, &glyph_width, &glyph_height, &x_offset, &y_offset);
+
+        if (pen_x + glyph_width + 1 >= FONT_ATLAS_WIDTH) {
+            pen_y += row_height + 1;
+            pen_x = 1;
+            row_height = 0;
+        }
+        assert(pen_y + glyph_height < FONT_ATLAS_HEIGHT); // Atlas is too small for this text height
+
+        for (i32 row = 0; row < glyph_height; row++) {
+            memcpy(out_bitmap + (pen_y + row) * FONT_ATLAS_WIDTH + pen_x, sdf + row * glyph_width,
+                   (usize)glyph_width);
+        }
+        stbtt_FreeSDF(sdf, nullptr);
+
+        stbtt_bakedchar &baked = out_char_data[i];
+        baked.x0 = (u16)pen_x;
+        baked.y0 = (u16)pen_y;
+        baked.x1 = (u16)(pen_x + glyph_width);
+        baked.y1 = (u16)(pen_y + glyph_height);
+        baked.xoff = (f32)x_offset;
+        baked.yoff = (f32)y_offset;
+        baked.xadvance = scale * (f32)advance;
+
+        pen_x += glyph_width + 1;
+        row_height = glyph_height > row_height ? glyph_height : row_height;
+    }
 
-    free(font_bytes);
 }
 
-FontData::FontData(FontData &&rhs) : ascent(rhs.ascent), descent(rhs.descent) {
-    font_char_data = std::move(rhs.font_char_data);
-    font_bitmap = rhs.font_bitmap;
-    rhs.font_bitmap = nullptr;
+static FontCacheHeader font_cache_header(u64 font_hash) {
+    FontCacheHeader header;
+    memset(&header, 0, sizeof(header)); // Padding goes into the file too, keep it deterministic
+    header.magic = FONT_CACHE_MAGIC;
+    header.version = FONT_CACHE_VERSION;
+    header.font_hash = font_hash;
+    header.text_height = FONT_TEXT_HEIGHT;
+    header.atlas_width = FONT_ATLAS_WIDTH;
+    header.atlas_height = FONT_ATLAS_HEIGHT;
+    header.first_char = ' ';
+    header.char_count = CHAR_COUNT;
+    header.sdf_padding = FONT_SDF_PADDING;
+    header.sdf_onedge = FONT_SDF_ONEDGE;
+    return header;
+}
+
+static bool font_cache_is_valid(const MappedFile &cache, const FontCacheHeader &expected) {
+    const usize expected_size =
+        sizeof(FontCacheHeader) + CHAR_COUNT * sizeof(stbtt_bakedchar) + FONT_ATLAS_WIDTH * FONT_ATLAS_HEIGHT;
+    if (cache.data == nullptr || cache.size != expected_size) {
+        return false;
+    }
+
+    const FontCacheHeader *header = (const FontCacheHeader *)cache.data;
+    return header->magic == expected.magic && header->version == expected.version &&
+           header->font_hash == expected.font_hash && header->text_height == expected.text_height &&
+           header->atlas_width == expected.atlas_width && header->atlas_height == expected.atlas_height &&
+           header->first_char == expected.first_char && header->char_count == expected.char_count &&
+           header->sdf_padding == expected.sdf_padding && header->sdf_onedge == expected.sdf_onedge;
+}
+
+// False when it couldn't be written. Not fatal, we'll bake again next time
+static bool font_cache_write(const std::string &cache_path, const FontCacheHeader &header,
+                             const stbtt_bakedchar *char_data, const u8 *bitmap) {
+    FILE *f = fopen(cache_path.c_str(), "wb");
+    if (!f) {
+        printf("failed to open font cache %s for writing\n", cache_path.c_str());
+        return false;
+    }
+
+    const usize bitmap_size = FONT_ATLAS_WIDTH * FONT_ATLAS_HEIGHT;
+    const bool is_written = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                            fwrite(char_data, sizeof(stbtt_bakedchar), CHAR_COUNT, f) == (usize)CHAR_COUNT &&
+                            fwrite(bitmap, 1, bitmap_size, f) == bitmap_size;
+    const bool is_closed = fclose(f) == 0;
+    if (!is_written || !is_closed) {
+        printf("failed to write font cache %s\n", cache_path.c_str());
+        remove(cache_path.c_str()); // A short one would only be rejected on the next launch
+        return false;
+    }
+    return true;
+}
+
+FontData::FontData(const std::string &ttf_path) {
+    usize font_length = 0;
+    font_bytes = (u8 *)Util::read_file(ttf_path.c_str(), &font_length);
+    assert(font_bytes != nullptr);
+
+    // Baking takes much longer than hashing the font. If an earlier launch baked it with the same
+    // parameters, the atlas goes straight from the mapped file to the GPU
+    const std::string cache_path = ttf_path + ".atlascache";
+    const FontCacheHeader expected_header = font_cache_header(Util::hash_bytes(font_bytes, font_length));
+    MappedFile cache = Util::map_file(cache_path.c_str());
+
+    const u8 *font_bitmap = nullptr;
+    u8 *baked_bitmap = nullptr;
+    if (font_cache_is_valid(cache, expected_header)) {
+        const FontCacheHeader *header = (const FontCacheHeader *)cache.data;
+        ascent = header->ascent;
+        descent = header->descent;
+        memcpy(font_char_data.data(), cache.data + sizeof(FontCacheHeader),
+               CHAR_COUNT * sizeof(stbtt_bakedchar));
+        font_bitmap = cache.data + sizeof(FontCacheHeader) + CHAR_COUNT * sizeof(stbtt_bakedchar);
+    } else {
+        // Closed before it's written over. Windows keeps a mapped file locked, every launch would bake again
+        Util::unmap_file(cache);
+
+        baked_bitmap = new u8[FONT_ATLAS_WIDTH * FONT_ATLAS_HEIGHT];
+        font_bake_atlas(font_bytes, baked_bitmap, font_char_data.data(), &ascent, &descent);
+
+        FontCacheHeader header = expected_header;
+        header.ascent = ascent;
+        header.descent = descent;
+        font_cache_write(cache_path, header, font_char_data.data(), baked_bitmap);
+        font_bitmap = baked_bitmap;
+    }
+
+    // The atlas is uploaded once here and every widget samples the same texture. Needs a GL context,
+    // which is why the renderer is constructed before the font data
+    glGenTextures(1, &(atlas_texture));
+    glBindTexture(GL_TEXTURE_2D_ARRAY, atlas_texture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8, FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT, FONT_ATLAS_PAGE_COUNT, 0,
+                 GL_RED, GL_UNSIGNED_BYTE, NULL);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT, 1, GL_RED,
+                    GL_UNSIGNED_BYTE, font_bitmap);
+
+    // The gaps between glyphs get sampled at the edges, so the dynamic pages have to start out empty
+    std::vector<u8> empty_page(FONT_ATLAS_WIDTH * FONT_ATLAS_HEIGHT, 0);
+    for (i32 page = 1; page < FONT_ATLAS_PAGE_COUNT; page++) {
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, page, FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT, 1, GL_RED,
+                        GL_UNSIGNED_BYTE, empty_page.data());
+    }
+
+    // The GPU has its own copy now
+    delete[] baked_bitmap;
+    Util::unmap_file(cache); // Nothing when it was baked
+
+    // The font itself stays around for the glyphs outside ASCII
+    stbtt_InitFont(&font_info, font_bytes, 0);
+    scale = stbtt_ScaleForPixelHeight(&font_info, FONT_TEXT_HEIGHT);
+    glyphs.reserve(256);
+    for (FontAtlasPage &page : pages) {
+        page.shelf_bottom = 1; // Keeping a one pixel border, like the baked page
+        page.last_used = 0;
+    }
+    use_clock = 0;
+    generation = 0;
 }
 
 FontData::~FontData() {
-    delete font_bitmap;
+    glDeleteTextures(1, &atlas_texture);
+    free(font_bytes);
+}
+
+FontGlyph FontData::get_glyph(u32 codepoint) {
+    if (codepoint >= ' ' && codepoint < ' ' + CHAR_COUNT) {
+        FontGlyph glyph;
+        glyph.baked = font_char_data[codepoint - ' '];
+        glyph.page = 0;
+        return glyph;
+    }
+
+    auto it = glyphs.find(codepoint);
+    if (it != glyphs.end()) {
+        pages[it->second.page].last_used = ++use_clock;
+        return it->second;
+    }
+
+    return rasterise_glyph(codepoint);
+}
+
+void FontData::touch_pages(u32 page_mask) {
+    use_clock++;
+    for (u32 page = 1; page < FONT_ATLAS_PAGE_COUNT; page++) {
+        if (page_mask & (1u << page)) {
+            pages[page].last_used = use_clock;
+        }
+    }
+}
+
+FontGlyph FontData::rasterise_glyph(u32 codepoint) {
+    const f32 pixel_dist_scale = (f32)FONT_SDF_ONEDGE / (f32)FONT_SDF_PADDING;
+    i32 advance, left_side_bearing;
+    stbtt_GetCodepointHMetrics(&font_info, (i32)codepoint, &advance, &left_side_bearing);
+
+    // Missing codepoints come back as the font's notdef glyph, shapeless ones as null with zero size
+    i32 glyph_width = 0, glyph_height = 0, x_offset = 0, y_offset = 0;
+    u8 *sdf = stbtt_GetCodepointSDF(&font_info, scale, (i32)codepoint, FONT_SDF_PADDING, FONT_SDF_ONEDGE,
+                                    pixel_dist_scale, &glyph_width, &glyph_height, &x_offset, &y_offset);
+
+    FontGlyph glyph = {};
+    glyph.baked.xoff = (f32)x_offset;
+    glyph.baked.yoff = (f32)y_offset;
+    glyph.baked.xadvance = scale * (f32)advance;
+
+    if (sdf != nullptr) {
+        u32 x = 0, y = 0;
+        u32 page = 1;
+        for (; page < FONT_ATLAS_PAGE_COUNT; page++) {
+            if (page_allocate(pages[page], (u32)glyph_width, (u32)glyph_height, &x, &y)) {
+                break;
+            }
+        }
+
+        if (page == FONT_ATLAS_PAGE_COUNT) {
+            page = evict_lru_page();
+            bool did_fit = page_allocate(pages[page], (u32)glyph_width, (u32)glyph_height, &x, &y);
+            assert(did_fit); // A single glyph bigger than a page
+        }
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, atlas_texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Glyph rows aren't 4 byte aligned
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, (i32)x, (i32)y, (i32)page, glyph_width, glyph_height, 1,
+                        GL_RED, GL_UNSIGNED_BYTE, sdf);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        stbtt_FreeSDF(sdf, nullptr);
+
+        glyph.baked.x0 = (u16)x;
+        glyph.baked.y0 = (u16)y;
+        glyph.baked.x1 = (u16)(x + (u32)glyph_width);
+        glyph.baked.y1 = (u16)(y + (u32)glyph_height);
+        glyph.page = page;
+        pages[page].last_used = ++use_clock;
+    }
+
+    glyphs.insert(std::make_pair(codepoint, glyph));
+    return glyph;
 }
 
-void WidgetData::set_str(u32 integer) {
-    char int_str_buffer[32];
-    sprintf_s(int_str_buffer, sizeof(char) * 32, "%d", integer);
-    text = int_str_buffer;
+bool FontData::page_allocate(FontAtlasPage &page, u32 width, u32 height, u32 *out_x, u32 *out_y) {
+    // One pixel gap between the glyphs, so that the filtering doesn't bleed into the neighbours
+    const u32 slot_width = width + 1;
+    const u32 slot_height = height + 1;
+
+    // Best fitting shelf that's tall enough and still has room
+    FontAtlasShelf *best_shelf = nullptr;
+    for (FontAtlasShelf &shelf : page.shelves) {
+        if (shelf.height >= slot_height && shelf.x_cursor + slot_width <= FONT_ATLAS_WIDTH &&
+            (best_shelf == nullptr || shelf.height < best_shelf->height)) {
+            best_shelf = &shelf;
+        }
+    }
+
+    if (best_shelf == nullptr) {
+        if (page.shelf_bottom + slot_height > FONT_ATLAS_HEIGHT || 1 + slot_width > FONT_ATLAS_WIDTH) {
+            return false;
+        }
+
+        FontAtlasShelf shelf;
+        shelf.y = page.shelf_bottom;
+        shelf.height = slot_height;
+        shelf.x_cursor = 1;
+        page.shelves.push_back(shelf);
+        page.shelf_bottom += slot_height;
+        best_shelf = &page.shelves.back();
+    }
+
+    *out_x = best_shelf->x_cursor;
+    *out_y = best_shelf->y;
+    best_shelf->x_cursor += slot_width;
+    return true;
+}
+
+u32 FontData::evict_lru_page() {
+    u32 lru_page = 1;
+    for (u32 page = 2; page < FONT_ATLAS_PAGE_COUNT; page++) {
+        if (pages[page].last_used < pages[lru_page].last_used) {
+            lru_page = page;
+        }
+    }
+
+    for (auto it = glyphs.begin(); it != glyphs.end();) {
+        if (it->second.page == lru_page) {
+            it = glyphs.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    pages[lru_page].shelves.clear();
+    pages[lru_page].shelf_bottom = 1;
+
+    std::vector<u8> empty_page(FONT_ATLAS_WIDTH * FONT_ATLAS_HEIGHT, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, atlas_texture);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (i32)lru_page, FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT, 1,
+                    GL_RED, GL_UNSIGNED_BYTE, empty_page.data());
+
+    generation++;
+    return lru_page;
+}
+
+//
+// WidgetData
+//
+
+WidgetData::WidgetData(const std::string &text_, TextTransform transform, FontData &font_data)
+    : text_length(0), text_version(0), transform(transform), font_data(font_data),
+      value_type(WidgetValueType::None), value_u32(0), value_f32(0.0f), value_format(nullptr) {
+    text[0] = '\0';
+    set_text(text_.c_str());
+}
+
+void WidgetData::set_text(const char *new_text) {
+    value_type = WidgetValueType::None;
+
+    usize length = strlen(new_text);
+    if (length >= WIDGET_TEXT_CAPACITY) {
+        // Cut at a codepoint boundary, so that we don't end up with half a character
+        length = WIDGET_TEXT_CAPACITY - 1;
+        while (length > 0 && ((u8)new_text[length] & 0xC0) == 0x80) {
+            length--;
+        }
+    }
+
+    if (length == text_length && memcmp(text, new_text, length) == 0) {
+        return;
+    }
+
+    memcpy(text, new_text, length);
+    text[length] = '\0';
+    text_length = (u32)length;
+    text_version++;
+}
+
+void WidgetData::set_u32(u32 value) {
+    if (value_type == WidgetValueType::U32 && value_u32 == value) {
+        return;
+    }
+
+    i32 length = snprintf(text, WIDGET_TEXT_CAPACITY, "%u", value);
+    text_length = (u32)length;
+    text_version++;
+
+    value_type = WidgetValueType::U32;
+    value_u32 = value;
+}
+
+void WidgetData::set_f32(f32 value, const char *format) {
+    if (value_type == WidgetValueType::F32 && value_f32 == value && value_format == format) {
+        return;
+    }
+
+    i32 length = snprintf(text, WIDGET_TEXT_CAPACITY, format, (double)value);
+    text_length = length < WIDGET_TEXT_CAPACITY ? (u32)length : WIDGET_TEXT_CAPACITY - 1; // Truncated
+    text_version++;
+
+    value_type = WidgetValueType::F32;
+    value_f32 = value;
+    value_format = format;
 }
 
 //
@@ -171,79 +537,41 @@ void GoRenderUnit::draw(const Mat4 &model) {
 // WidgetRenderUnit
 //
 
-WidgetRenderUnit::WidgetRenderUnit(std::weak_ptr<Shader> shader, const WidgetData &widget) : shader(shader) {
-    glGenVertexArrays(1, &(vao));
-    glGenBuffers(1, &(vbo));
-    glGenBuffers(1, &(ibo));
-
-    glBindVertexArray(vao);
-
-    // @DOCS: We provide empty buffers here, otherwise the pointers don't
-    // know what buffer they point to (or something)
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 0, NULL, GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(f32), (void *)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(f32), (void *)(2 * sizeof(f32)));
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    glGenTextures(1, &(texture));
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE,
-                 widget.font_data.font_bitmap);
-
-    // glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // We might need to do this if we get segfaults
-
-    std::shared_ptr<Shader> shader_pin = shader.lock();
-    shader_pin->set_int("u_texture_ui", 0);
-
+WidgetRenderUnit::WidgetRenderUnit(const WidgetData &widget)
+    : laid_out_length(0), laid_out_version(0), atlas_texture(widget.font_data.atlas_texture),
+      font_generation(widget.font_data.generation), page_mask(0), glyph_count(0), glyph_capacity(0),
+      dirty_begin(0), dirty_end(0) {
+    laid_out_text[0] = '\0';
     update(widget);
 }
 
-WidgetRenderUnit::WidgetRenderUnit(WidgetRenderUnit &&rhs)
-    : vao(rhs.vao), vbo(rhs.vbo), ibo(rhs.ibo), index_count(rhs.index_count), shader(rhs.shader),
-      texture(rhs.texture) {
-    rhs.vao = 0;
-    rhs.vbo = 0;
-    rhs.ibo = 0;
-    rhs.shader.reset();
-    rhs.texture = 0;
+u32 WidgetRenderUnit::get_glyph_count() const {
+    return glyph_count;
 }
 
-WidgetRenderUnit::~WidgetRenderUnit() {
-    glDeleteVertexArrays(1, &(vao));
-    glDeleteBuffers(1, &(vbo));
-    glDeleteBuffers(1, &(ibo));
-    glDeleteTextures(1, &texture);
-    // No deleting the shader. We don't own it
+u32 WidgetRenderUnit::get_glyph_capacity() const {
+    return glyph_capacity;
 }
 
-void WidgetRenderUnit::text_buffer_fill(TextBufferData *text_data, const FontData &font_data,
-                                        const char *text, TextTransform transform) {
-    const usize char_count = strlen(text);
-
+void WidgetRenderUnit::text_buffer_fill(f32 *vert_data, FontData &font_data, const char *text,
+                                        u32 first_glyph, u32 char_count, TextTransform transform) {
+    // text starts at first_glyph's bytes, char_count is the codepoint count of the whole text
     Vec2 anchor = transform.anchor;
     f32 width = transform.width_type == TextWidthType::FixedWidth ? (transform.width / (f32)char_count)
                                                                   : transform.width;
     f32 height = transform.height;
 
-    u32 vert_curr = 0;
-    u32 ind_curr = 0;
-    for (usize i = 0; i < char_count; i++) {
-        char ch = text[i];
+    u32 vert_curr = first_glyph * UI_GLYPH_FLOAT_COUNT;
+    usize cursor = 0;
+    for (u32 i = first_glyph; i < char_count; i++) {
+        FontGlyph glyph = font_data.get_glyph(Util::utf8_decode(text, &cursor));
+        page_mask |= 1u << glyph.page;
+        const f32 page = (f32)glyph.page;
+
         f32 pixel_pos_x = 0, pixel_pos_y = 0; // Don't exactly know what these are for
         stbtt_aligned_quad quad;
-        stbtt_GetBakedQuad(font_data.font_char_data.data(), FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT, ch - ' ',
-                           &pixel_pos_x, &pixel_pos_y, &quad, 1);
+        stbtt_GetBakedQuad(&glyph.baked, FONT_ATLAS_WIDTH, FONT_ATLAS_HEIGHT, 0, &pixel_pos_x, &pixel_pos_y,
+                           &quad, 1);
 
         // This calculation is difficult to wrap the head around. Draw it
         // on paper to make it clearer in the head descent is negative:
@@ -259,138 +587,326 @@ void WidgetRenderUnit::text_buffer_fill(TextBufferData *text_data, const FontDat
         // UVs
 
         // Bottom left vertex
-        text_data->vb_data[vert_curr + 0] = (f32)i * width + anchor.x;        // X:0
-        text_data->vb_data[vert_curr + 1] = glyph_bottom * height + anchor.y; // Y:0
-        text_data->vb_data[vert_curr + 2] = quad.s0;                          // U
-        text_data->vb_data[vert_curr + 3] = 1.0f - quad.t1;                   // V
+        vert_data[vert_curr + 0] = (f32)i * width + anchor.x;        // X:0
+        vert_data[vert_curr + 1] = glyph_bottom * height + anchor.y; // Y:0
+        vert_data[vert_curr + 2] = quad.s0;                          // U
+        vert_data[vert_curr + 3] = 1.0f - quad.t1;                   // V
+        vert_data[vert_curr + 4] = page;                             // Atlas page
 
         // Bottom right vertex
-        text_data->vb_data[vert_curr + 4] = (f32)(i + 1) * width + anchor.x;  // 1
-        text_data->vb_data[vert_curr + 5] = glyph_bottom * height + anchor.y; // 0
-        text_data->vb_data[vert_curr + 6] = quad.s1;                          // U
-        text_data->vb_data[vert_curr + 7] = 1.0f - quad.t1;                   // V
+        vert_data[vert_curr + 5] = (f32)(i + 1) * width + anchor.x;  // 1
+        vert_data[vert_curr + 6] = glyph_bottom * height + anchor.y; // 0
+        vert_data[vert_curr + 7] = quad.s1;                          // U
+        vert_data[vert_curr + 8] = 1.0f - quad.t1;                   // V
+        vert_data[vert_curr + 9] = page;                             // Atlas page
 
         // Top right vertex
-        text_data->vb_data[vert_curr + 8] = (f32)(i + 1) * width + anchor.x; // 1
-        text_data->vb_data[vert_curr + 9] = glyph_top * height + anchor.y;   // 1
-        text_data->vb_data[vert_curr + 10] = quad.s1;                        // U
-        text_data->vb_data[vert_curr + 11] = 1.0f - quad.t0;                 // V
+        vert_data[vert_curr + 10] = (f32)(i + 1) * width + anchor.x; // 1
+        vert_data[vert_curr + 11] = glyph_top * height + anchor.y;   // 1
+        vert_data[vert_curr + 12] = quad.s1;                         // U
+        vert_data[vert_curr + 13] = 1.0f - quad.t0;                  // V
+        vert_data[vert_curr + 14] = page;                            // Atlas page
 
         // Top left vertex
-        text_data->vb_data[vert_curr + 12] = (f32)i * width + anchor.x;     // 0
-        text_data->vb_data[vert_curr + 13] = glyph_top * height + anchor.y; // 1
-        text_data->vb_data[vert_curr + 14] = quad.s0;                       // U
-        text_data->vb_data[vert_curr + 15] = 1.0f - quad.t0;                // V
+        vert_data[vert_curr + 15] = (f32)i * width + anchor.x;     // 0
+        vert_data[vert_curr + 16] = glyph_top * height + anchor.y; // 1
+        vert_data[vert_curr + 17] = quad.s0;                       // U
+        vert_data[vert_curr + 18] = 1.0f - quad.t0;                // V
+        vert_data[vert_curr + 19] = page;                          // Atlas page
 
-        // Two triangles. Each char is 4 vertex
-        text_data->ib_data[ind_curr + 0] = ((u32)i * 4) + 0;
-        text_data->ib_data[ind_curr + 1] = ((u32)i * 4) + 1;
-        text_data->ib_data[ind_curr + 2] = ((u32)i * 4) + 2;
-        text_data->ib_data[ind_curr + 3] = ((u32)i * 4) + 0;
-        text_data->ib_data[ind_curr + 4] = ((u32)i * 4) + 2;
-        text_data->ib_data[ind_curr + 5] = ((u32)i * 4) + 3;
-
-        vert_curr += 16;
-        ind_curr += 6;
+        vert_curr += UI_GLYPH_FLOAT_COUNT;
     }
 }
 
 void WidgetRenderUnit::update(const WidgetData &widget) {
-    usize char_count = widget.text.length();
+    const char *text = widget.text;
+    const usize text_length = widget.text_length;
+    const u32 char_count = Util::utf8_length(text, text_length);
+    laid_out_version = widget.text_version;
+
+    if (char_count > glyph_capacity) {
+        // Some headroom, so that a growing counter doesn't make the batch move this range every time
+        glyph_capacity = char_count + char_count / 2 + UI_WIDGET_GLYPH_HEADROOM;
+        vert_data.resize(glyph_capacity * UI_GLYPH_FLOAT_COUNT, 0.0f);
+    }
 
-    TextBufferData text_data;
-    text_data.vb_len = char_count * 16 * sizeof(f32);
-    text_data.ib_len = char_count * 6 * sizeof(u32);
-    text_data.vb_data = (f32 *)malloc(text_data.vb_len);
-    text_data.ib_data = (u32 *)malloc(text_data.ib_len);
+    // An eviction may have taken glyphs we point at, then everything is laid out again. Fixed width
+    // spreads the same width over all characters, a length change moves every one of them too
+    const bool is_atlas_stale = font_generation != widget.font_data.generation;
+    usize first_changed_byte = 0;
+    u32 first_changed = 0;
+    if (!is_atlas_stale &&
+        (widget.transform.width_type == TextWidthType::FreeWidth || char_count == glyph_count)) {
+        while (first_changed_byte < text_length && first_changed_byte < laid_out_length &&
+               text[first_changed_byte] == laid_out_text[first_changed_byte]) {
+            first_changed_byte++;
+        }
+
+        if (first_changed_byte == text_length && text_length == laid_out_length) {
+            return; // Same text
+        }
+
+        // Back to the start of the codepoint that differs
+        while (first_changed_byte > 0 && ((text[first_changed_byte] & 0xC0) == 0x80 ||
+                                          (laid_out_text[first_changed_byte] & 0xC0) == 0x80)) {
+            first_changed_byte--;
+        }
+        first_changed = Util::utf8_length(text, first_changed_byte);
+    }
 
-    text_buffer_fill(&text_data, widget.font_data, widget.text.c_str(), widget.transform);
+    if (first_changed == 0) {
+        page_mask = 0;
+    }
 
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)text_data.vb_len, text_data.vb_data, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)text_data.ib_len, text_data.ib_data, GL_STATIC_DRAW);
-    index_count = (u32)text_data.ib_len;
+    const u32 generation_before = widget.font_data.generation;
+    text_buffer_fill(vert_data.data(), widget.font_data, text + first_changed_byte, first_changed, char_count,
+                     widget.transform);
+
+    if (widget.font_data.generation != generation_before) {
+        // The atlas ran out of room halfway and may have evicted a glyph we had just placed. Our own
+        // glyphs are the most recently used ones now, so a second pass keeps them
+        first_changed = 0;
+        page_mask = 0;
+        text_buffer_fill(vert_data.data(), widget.font_data, text, 0, char_count, widget.transform);
+    }
+    font_generation = widget.font_data.generation;
+
+    if (char_count < glyph_count) {
+        // Zero sized quads for the leftovers, they still go into the draw but don't produce any pixels
+        memset(vert_data.data() + char_count * UI_GLYPH_FLOAT_COUNT, 0,
+               (glyph_count - char_count) * UI_GLYPH_FLOAT_COUNT * sizeof(f32));
+    }
 
-    free(text_data.vb_data);
-    free(text_data.ib_data);
+    const u32 changed_end = char_count > glyph_count ? char_count : glyph_count;
+    if (dirty_begin == dirty_end) {
+        dirty_begin = first_changed;
+        dirty_end = changed_end;
+    } else {
+        dirty_begin = first_changed < dirty_begin ? first_changed : dirty_begin;
+        dirty_end = changed_end > dirty_end ? changed_end : dirty_end;
+    }
+
+    memcpy(laid_out_text, text, text_length + 1); // With the terminator
+    laid_out_length = (u32)text_length;
+    glyph_count = char_count;
 }
 
-void WidgetRenderUnit::draw() {
-    std::shared_ptr<Shader> shader_pinned = shader.lock();
-    shader_pinned->use();
-    glBindVertexArray(vao);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glDrawElements(GL_TRIANGLES, (GLsizei)index_count, GL_UNSIGNED_INT, 0);
+void WidgetRenderUnit::refresh(const WidgetData &widget) {
+    // Visible text keeps its pages recently used, so the eviction goes for pages nobody is looking at
+    widget.font_data.touch_pages(page_mask);
+
+    // Nothing to do on frames where the text didn't change
+    if (laid_out_version != widget.text_version || font_generation != widget.font_data.generation) {
+        update(widget);
+    }
 }
 
 //
-// ParticleRenderUnit
+// UiBatch
 //
 
-ParticleRenderUnit::ParticleRenderUnit(usize particle_count, RenderInfo render_info,
-                                       const std::string &texture_file_name) {
+UiBatch::UiBatch() : glyph_capacity(0) {
+    glGenVertexArrays(1, &(vao));
+    glGenBuffers(1, &(vbo));
+    glGenBuffers(1, &(ibo));
 
-    shader = std::make_unique<Shader>("engine/src/shader/world.glsl"); // Using world shader for now
+    glBindVertexArray(vao);
 
-    Mat4 mat_identity = Mat4::identity();
-    shader->set_mat4("u_model", mat_identity);
-    shader->set_mat4("u_view", render_info.view);
-    shader->set_mat4("u_proj", render_info.proj);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    reserve(UI_BATCH_INITIAL_GLYPH_CAPACITY);
 
-    f32 single_particle_vert[8] = {-0.5f, -0.5f, 0.5f, -0.5f, 0.5f, 0.5f, -0.5f, 0.5f};
-    vert_data_len = (u32)particle_count * sizeof(single_particle_vert);
-    vert_data = (f32 *)malloc(vert_data_len);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(f32), (void *)0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(f32), (void *)(2 * sizeof(f32)));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-    f32 single_particle_uvs[8] = {0, 0, 1, 0, 1, 1, 0, 1};
-    usize uv_data_len = particle_count * sizeof(single_particle_uvs);
-    f32 *uv_data = (f32 *)malloc(uv_data_len);
+UiBatch::~UiBatch() {
+    glDeleteVertexArrays(1, &(vao));
+    glDeleteBuffers(1, &(vbo));
+    glDeleteBuffers(1, &(ibo));
+}
 
-    u32 single_particle_index[6] = {0, 1, 2, 0, 2, 3};
-    usize index_data_len = particle_count * sizeof(single_particle_index);
-    u32 *index_data = (u32 *)malloc(index_data_len);
+void UiBatch::reserve(u32 capacity) {
+    // Expects the VAO to be bound, the index buffer binding is part of its state
+    glyph_capacity = capacity;
 
-    for (u32 i = 0; i < (u32)particle_count; i++) {
-        // Learning: '+' operator for pointers doesn't increment by bytes.
-        // The increment amount is of the pointer's type. So for this one below, it increments 8 f32s.
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(capacity * UI_GLYPH_FLOAT_COUNT * sizeof(f32)), NULL,
+                 GL_DYNAMIC_DRAW);
+
+    // Two triangles. Each char is 4 vertex
+    std::vector<u32> index_data(capacity * 6);
+    for (u32 i = 0; i < capacity; i++) {
+        index_data[i * 6 + 0] = (i * 4) + 0;
+        index_data[i * 6 + 1] = (i * 4) + 1;
+        index_data[i * 6 + 2] = (i * 4) + 2;
+        index_data[i * 6 + 3] = (i * 4) + 0;
+        index_data[i * 6 + 4] = (i * 4) + 2;
+        index_data[i * 6 + 5] = (i * 4) + 3;
+    }
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)(index_data.size() * sizeof(u32)), index_data.data(),
+                 GL_STATIC_DRAW);
 
-        memcpy(vert_data + i * 8, single_particle_vert, sizeof(single_particle_vert));
+    // Everything has to be uploaded again into the new storage
+    ranges.clear();
+}
 
-        u32 particle_index_at_i[6] = {
-            single_particle_index[0] + (i * 4), single_particle_index[1] + (i * 4),
-            single_particle_index[2] + (i * 4), single_particle_index[3] + (i * 4),
-            single_particle_index[4] + (i * 4), single_particle_index[5] + (i * 4),
-        };
-        memcpy(index_data + i * 6, particle_index_at_i, sizeof(particle_index_at_i));
+void UiBatch::draw(const std::vector<WidgetRenderUnit *> &units, Shader &shader) {
+    // Widgets sharing an atlas have to sit next to each other, so that they go out in a single draw
+    sorted_units.assign(units.begin(), units.end());
+    std::stable_sort(sorted_units.begin(), sorted_units.end(),
+                     [](const WidgetRenderUnit *a, const WidgetRenderUnit *b) {
+                         return a->atlas_texture < b->atlas_texture;
+                     });
+
+    u32 total_glyph_capacity = 0;
+    for (const WidgetRenderUnit *unit : sorted_units) {
+        total_glyph_capacity += unit->get_glyph_capacity();
+    }
 
-        memcpy(uv_data + i * 8, single_particle_uvs, sizeof(single_particle_uvs));
+    glBindVertexArray(vao);
+
+    if (total_glyph_capacity > glyph_capacity) {
+        reserve(total_glyph_capacity * 2);
     }
 
-    index_count = (u32)index_data_len;
+    // A range stays where it is as long as the widgets before it are the same ones with the same capacities.
+    // Everything after the first mismatch (scene change, a text outgrowing its capacity) is packed again
+    usize first_stale = 0;
+    while (first_stale < ranges.size() && first_stale < sorted_units.size() &&
+           ranges[first_stale].unit == sorted_units[first_stale] &&
+           ranges[first_stale].glyph_capacity == sorted_units[first_stale]->get_glyph_capacity()) {
+        first_stale++;
+    }
+    ranges.resize(first_stale);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    for (usize i = 0; i < sorted_units.size(); i++) {
+        WidgetRenderUnit *unit = sorted_units[i];
+
+        u32 upload_begin = unit->dirty_begin;
+        u32 upload_end = unit->dirty_end;
+        if (i >= first_stale) {
+            UiBatchRange range;
+            range.unit = unit;
+            range.glyph_offset = i == 0 ? 0 : ranges[i - 1].glyph_offset + ranges[i - 1].glyph_capacity;
+            range.glyph_capacity = unit->get_glyph_capacity();
+            ranges.push_back(range);
+
+            upload_begin = 0; // Moved, the whole range goes up
+            upload_end = range.glyph_capacity;
+        }
+
+        if (upload_begin == upload_end) {
+            continue;
+        }
+
+        const u32 first_glyph = ranges[i].glyph_offset + upload_begin;
+        glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(first_glyph * UI_GLYPH_FLOAT_COUNT * sizeof(f32)),
+                        (GLsizeiptr)((upload_end - upload_begin) * UI_GLYPH_FLOAT_COUNT * sizeof(f32)),
+                        unit->vert_data.data() + upload_begin * UI_GLYPH_FLOAT_COUNT);
+        unit->dirty_begin = 0;
+        unit->dirty_end = 0;
+    }
+
+    shader.use();
+    glActiveTexture(GL_TEXTURE0);
+
+    // One draw per atlas
+    usize group_begin = 0;
+    for (usize i = 1; i <= ranges.size(); i++) {
+        if (i < ranges.size() && ranges[i].unit->atlas_texture == ranges[group_begin].unit->atlas_texture) {
+            continue;
+        }
+
+        u32 first_glyph = ranges[group_begin].glyph_offset;
+        u32 glyph_count = ranges[i - 1].glyph_offset + ranges[i - 1].glyph_capacity - first_glyph;
+        if (glyph_count > 0) {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, ranges[group_begin].unit->atlas_texture);
+            glDrawElements(GL_TRIANGLES, (GLsizei)(glyph_count * 6), GL_UNSIGNED_INT,
+                           (void *)(first_glyph * 6 * sizeof(u32)));
+        }
+        group_begin = i;
+    }
+}
+
+//
+// ParticleBatch
+//
+
+ParticleBatch::ParticleBatch(RenderInfo render_info) : particle_capacity(0) {
+    shader = std::make_unique<Shader>("engine/src/shader/particle.glsl");
+    shader->set_mat4("u_view", render_info.view);
+    shader->set_mat4("u_proj", render_info.proj);
 
     glGenVertexArrays(1, &(vao));
     glGenBuffers(1, &(vbo));
-    glGenBuffers(1, &(ibo));
     glGenBuffers(1, &(uv_bo));
+    glGenBuffers(1, &(ibo));
 
     glBindVertexArray(vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    reserve(PARTICLE_BATCH_INITIAL_CAPACITY);
 
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, (GLsizei)vert_data_len, vert_data, GL_DYNAMIC_DRAW);
     glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(f32), (void *)0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 3 * sizeof(f32), (void *)0);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, 3 * sizeof(f32), (void *)(2 * sizeof(f32)));
 
     glBindBuffer(GL_ARRAY_BUFFER, uv_bo);
-    glBufferData(GL_ARRAY_BUFFER, (GLsizei)uv_data_len, uv_data, GL_STATIC_DRAW);
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(f32), (void *)0);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizei)index_data_len, index_data, GL_STATIC_DRAW);
+ParticleBatch::~ParticleBatch() {
+    glDeleteVertexArrays(1, &(vao));
+    glDeleteBuffers(1, &(vbo));
+    glDeleteBuffers(1, &(uv_bo));
+    glDeleteBuffers(1, &(ibo));
+
+    for (const auto &pair : textures) {
+        glDeleteTextures(1, &pair.second);
+    }
+}
 
+void ParticleBatch::reserve(u32 capacity) {
+    // Expects the VAO to be bound, the index buffer binding is part of its state
+    particle_capacity = capacity;
+    vert_data.resize(capacity * PARTICLE_VERT_FLOAT_COUNT);
+
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(vert_data.size() * sizeof(f32)), NULL, GL_STREAM_DRAW);
+
+    // UVs and indices are the same for every particle, they only change with the capacity
+    f32 single_particle_uvs[8] = {0, 0, 1, 0, 1, 1, 0, 1};
+    u32 single_particle_index[6] = {0, 1, 2, 0, 2, 3};
+    std::vector<f32> uv_data(capacity * 8);
+    std::vector<u32> index_data(capacity * 6);
+    for (u32 i = 0; i < capacity; i++) {
+        memcpy(uv_data.data() + i * 8, single_particle_uvs, sizeof(single_particle_uvs));
+        for (u32 j = 0; j < 6; j++) {
+            index_data[i * 6 + j] = single_particle_index[j] + (i * 4);
+        }
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, uv_bo);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(uv_data.size() * sizeof(f32)), uv_data.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)(index_data.size() * sizeof(u32)), index_data.data(),
+                 GL_STATIC_DRAW);
+}
+
+texture_handle ParticleBatch::get_texture(const std::string &texture_file_name) {
+    auto it = textures.find(texture_file_name);
+    if (it != textures.end()) {
+        return it->second;
+    }
+
+    texture_handle texture;
     glGenTextures(1, &(texture));
     glBindTexture(GL_TEXTURE_2D, texture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -406,57 +922,317 @@ ParticleRenderUnit::ParticleRenderUnit(usize particle_count, RenderInfo render_i
     glGenerateMipmap(GL_TEXTURE_2D);
     stbi_image_free(data);
 
-    free(index_data);
-    free(uv_data);
+    textures.insert(std::make_pair(texture_file_name, texture));
+    return texture;
 }
 
-ParticleRenderUnit::ParticleRenderUnit(ParticleRenderUnit &&rhs)
-    : vao(rhs.vao), vbo(rhs.vbo), uv_bo(rhs.uv_bo), ibo(rhs.ibo), index_count(rhs.index_count),
-      shader(std::move(rhs.shader)), texture(rhs.texture), vert_data_len(rhs.vert_data_len) {
+static void particle_quad_fill(f32 *vert, f32 x, f32 y, f32 half_size, f32 alpha) {
+    vert[0] = x - half_size;
+    vert[1] = y - half_size;
+    vert[2] = alpha;
+    vert[3] = x + half_size;
+    vert[4] = y - half_size;
+    vert[5] = alpha;
+    vert[6] = x + half_size;
+    vert[7] = y + half_size;
+    vert[8] = alpha;
+    vert[9] = x - half_size;
+    vert[10] = y + half_size;
+    vert[11] = alpha;
+}
 
-    rhs.vao = 0;
-    rhs.vbo = 0;
-    rhs.uv_bo = 0;
-    rhs.ibo = 0;
-    rhs.texture = 0;
+void ParticleBatch::draw(std::vector<ParticleBatchItem> &items) {
+    // Same textures next to each other, so that each texture is one contiguous range and one draw
+    std::stable_sort(items.begin(), items.end(), [](const ParticleBatchItem &a, const ParticleBatchItem &b) {
+        return a.texture < b.texture;
+    });
 
-    vert_data = rhs.vert_data;
-    rhs.vert_data = nullptr;
+    u32 particle_count = 0; // Upper bound, emitters can have dead ones waiting in the middle of their ring
+    for (const ParticleBatchItem &item : items) {
+        particle_count += item.source ? (u32)item.source->props.count : item.emitter->live_count;
+    }
+    if (particle_count == 0) {
+        return;
+    }
+
+    glBindVertexArray(vao);
+    if (particle_count > particle_capacity) {
+        reserve(particle_count * 2);
+    }
+
+    u32 vert_curr = 0;
+    for (ParticleBatchItem &item : items) {
+        const u32 item_vert_first = vert_curr;
+
+        if (item.source) {
+            const ParticleSource &ps = *item.source;
+            for (u32 i = 0; i < ps.props.count; i++) {
+                particle_quad_fill(vert_data.data() + vert_curr, ps.pos_x[i], ps.pos_y[i],
+                                   ps.props.size * 0.5f, ps.transparency);
+                vert_curr += PARTICLE_VERT_FLOAT_COUNT;
+            }
+        } else {
+            const ParticleEmitter &emitter = *item.emitter;
+            for (u32 i = 0; i < emitter.live_count; i++) {
+                const u32 slot = emitter.slot(i);
+                if (emitter.age[slot] >= emitter.lifetime[slot]) {
+                    continue;
+                }
+
+                const f32 t = emitter.age[slot] / emitter.lifetime[slot];
+                particle_quad_fill(vert_data.data() + vert_curr, emitter.pos_x[slot], emitter.pos_y[slot],
+                                   emitter.props.size_over_life.evaluate(t) * 0.5f,
+                                   emitter.props.alpha_over_life.evaluate(t));
+                vert_curr += PARTICLE_VERT_FLOAT_COUNT;
+            }
+        }
+
+        item.particle_count = (vert_curr - item_vert_first) / PARTICLE_VERT_FLOAT_COUNT;
+    }
+
+    // Orphaning first, so that we don't wait on the draws of the last frame that still read it
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(vert_data.size() * sizeof(f32)), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr)(vert_curr * sizeof(f32)), vert_data.data());
+
+    shader->use();
+    glActiveTexture(GL_TEXTURE0);
+
+    u32 group_first = 0;
+    u32 group_count = 0;
+    for (usize i = 0; i < items.size(); i++) {
+        group_count += items[i].particle_count;
+
+        if (i + 1 < items.size() && items[i + 1].texture == items[i].texture) {
+            continue;
+        }
+
+        glBindTexture(GL_TEXTURE_2D, items[i].texture);
+        glDrawElements(GL_TRIANGLES, (GLsizei)(group_count * 6), GL_UNSIGNED_INT,
+                       (void *)(group_first * 6 * sizeof(u32)));
+        group_first += group_count;
+        group_count = 0;
+    }
 }
 
-ParticleRenderUnit::~ParticleRenderUnit() {
-    glDeleteVertexArrays(1, &(vao));
-    glDeleteBuffers(1, &(vbo));
-    glDeleteBuffers(1, &(uv_bo));
-    glDeleteBuffers(1, &(ibo));
+//
+// GpuParticleSystem
+//
 
-    glDeleteTextures(1, &texture);
+GpuParticleSystem::GpuParticleSystem(u32 capacity, f32 size, texture_handle texture,
+                                     std::weak_ptr<Shader> sim_shader, std::weak_ptr<Shader> render_shader,
+                                     u64 seed)
+    : current(0), capacity(capacity), emit_cursor(0), size(size), texture(texture), sim_shader(sim_shader),
+      render_shader(render_shader), rng(seed) {
+
+    // All zeroes is age == lifetime == 0, which is a dead particle
+    std::vector<GpuParticle> empty_state(capacity);
+    memset(empty_state.data(), 0, capacity * sizeof(GpuParticle));
+
+    f32 quad_corners[8] = {-0.5f, -0.5f, 0.5f, -0.5f, 0.5f, 0.5f, -0.5f, 0.5f};
+    glGenBuffers(1, &(quad_vbo));
+    glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad_corners), quad_corners, GL_STATIC_DRAW);
+
+    glGenBuffers(2, state_buffers);
+    glGenVertexArrays(2, sim_vaos);
+    glGenVertexArrays(2, render_vaos);
+
+    const GLsizei stride = sizeof(GpuParticle);
+    for (u32 i = 0; i < 2; i++) {
+        glBindBuffer(GL_ARRAY_BUFFER, state_buffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(capacity * sizeof(GpuParticle)), empty_state.data(),
+                     GL_DYNAMIC_COPY);
+
+        glBindVertexArray(sim_vaos[i]);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, (void *)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void *)(2 * sizeof(f32)));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void *)(4 * sizeof(f32)));
+
+        // A quad per particle. The corners are per vertex, the particle state is per instance
+        glBindVertexArray(render_vaos[i]);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void *)0);
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void *)(4 * sizeof(f32)));
+        glVertexAttribDivisor(2, 1);
+
+        glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(f32), (void *)0);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+GpuParticleSystem::~GpuParticleSystem() {
+    glDeleteVertexArrays(2, sim_vaos);
+    glDeleteVertexArrays(2, render_vaos);
+    glDeleteBuffers(2, state_buffers);
+    glDeleteBuffers(1, &(quad_vbo));
+    // No deleting the shaders or the texture. We don't own them
+}
+
+void GpuParticleSystem::emit_burst(const ParticleProps &props, Vec2 emit_point) {
+    emit_scratch.resize(props.count);
+    for (u32 i = 0; i < (u32)props.count; i++) {
+        Vec2 velocity = particle_emit_velocity(props, i, rng);
+        GpuParticle &particle = emit_scratch[i];
+        particle.pos_x = emit_point.x;
+        particle.pos_y = emit_point.y;
+        particle.vel_x = velocity.x;
+        particle.vel_y = velocity.y;
+        particle.age = 0.0f;
+        particle.lifetime = props.lifetime;
+    }
+
+    // Into the ring, at most two uploads when it wraps around
+    glBindBuffer(GL_ARRAY_BUFFER, state_buffers[current]);
+    u32 emitted = 0;
+    while (emitted < (u32)props.count) {
+        u32 chunk = capacity - emit_cursor;
+        chunk = chunk < (u32)props.count - emitted ? chunk : (u32)props.count - emitted;
+        glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(emit_cursor * sizeof(GpuParticle)),
+                        (GLsizeiptr)(chunk * sizeof(GpuParticle)), emit_scratch.data() + emitted);
+        emitted += chunk;
+        emit_cursor = (emit_cursor + chunk) % capacity;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-    free(vert_data);
+void GpuParticleSystem::update(f32 dt) {
+    std::shared_ptr<Shader> shader_pin = sim_shader.lock();
+    shader_pin->set_f32("u_dt", dt);
+
+    const u32 next = 1 - current;
+    glEnable(GL_RASTERIZER_DISCARD); // Only the feedback is wanted out of this pass
+    glBindVertexArray(sim_vaos[current]);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, state_buffers[next]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, (GLsizei)capacity);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    current = next;
 }
 
-void ParticleRenderUnit::draw(const ParticleSource &ps) {
+void GpuParticleSystem::draw() {
+    std::shared_ptr<Shader> shader_pin = render_shader.lock();
+    shader_pin->set_f32("u_size", size);
 
-    // glUseProgram(shader);
+    glBindVertexArray(render_vaos[current]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, (GLsizei)capacity);
+}
+
+//
+// AnalyticParticleSystem
+//
+
+AnalyticParticleSystem::AnalyticParticleSystem(u32 capacity, f32 size, texture_handle texture,
+                                               std::weak_ptr<Shader> shader, u64 seed)
+    : capacity(capacity), emit_cursor(0), size(size), time(0.0f), texture(texture), shader(shader),
+      seeds(capacity), rng(seed) {
+
+    // Lifetime of zero is never alive, so the unused slots draw nothing
+    memset(seeds.data(), 0, capacity * sizeof(AnalyticParticleSeed));
+
+    f32 quad_corners[8] = {-0.5f, -0.5f, 0.5f, -0.5f, 0.5f, 0.5f, -0.5f, 0.5f};
+
+    glGenVertexArrays(1, &(vao));
     glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
-    f32 half_particle_size = ps.props.size * 0.5f;
-    for (u32 i = 0; i < ps.props.count; i++) {
-        Vec2 particle_pos = ps.positions[i];
-        vert_data[(i * 8) + 0] = particle_pos.x - half_particle_size;
-        vert_data[(i * 8) + 1] = particle_pos.y - half_particle_size;
-        vert_data[(i * 8) + 2] = particle_pos.x + half_particle_size;
-        vert_data[(i * 8) + 3] = particle_pos.y - half_particle_size;
-        vert_data[(i * 8) + 4] = particle_pos.x + half_particle_size;
-        vert_data[(i * 8) + 5] = particle_pos.y + half_particle_size;
-        vert_data[(i * 8) + 6] = particle_pos.x - half_particle_size;
-        vert_data[(i * 8) + 7] = particle_pos.y + half_particle_size;
+    glGenBuffers(1, &(quad_vbo));
+    glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad_corners), quad_corners, GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(f32), (void *)0);
+
+    const GLsizei stride = sizeof(AnalyticParticleSeed);
+    glGenBuffers(1, &(seed_buffer));
+    glBindBuffer(GL_ARRAY_BUFFER, seed_buffer);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(capacity * sizeof(AnalyticParticleSeed)), seeds.data(),
+                 GL_DYNAMIC_DRAW);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void *)0);
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void *)(2 * sizeof(f32)));
+    glVertexAttribDivisor(2, 1);
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, stride, (void *)(4 * sizeof(f32)));
+    glVertexAttribDivisor(3, 1);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+AnalyticParticleSystem::~AnalyticParticleSystem() {
+    glDeleteVertexArrays(1, &(vao));
+    glDeleteBuffers(1, &(seed_buffer));
+    glDeleteBuffers(1, &(quad_vbo));
+    // No deleting the shader or the texture. We don't own them
+}
+
+void AnalyticParticleSystem::emit_burst(const ParticleProps &props, Vec2 emit_point) {
+    // Into the ring, at most two uploads when it wraps around
+    glBindBuffer(GL_ARRAY_BUFFER, seed_buffer);
+    u32 emitted = 0;
+    while (emitted < (u32)props.count) {
+        u32 chunk = capacity - emit_cursor;
+        chunk = chunk < (u32)props.count - emitted ? chunk : (u32)props.count - emitted;
+        for (u32 i = 0; i < chunk; i++) {
+            Vec2 velocity = particle_emit_velocity(props, emitted + i, rng);
+            AnalyticParticleSeed &seed = seeds[emit_cursor + i];
+            seed.emit_x = emit_point.x;
+            seed.emit_y = emit_point.y;
+            seed.vel_x = velocity.x;
+            seed.vel_y = velocity.y;
+            seed.emit_time = time;
+            seed.lifetime = props.lifetime;
+        }
+        glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)(emit_cursor * sizeof(AnalyticParticleSeed)),
+                        (GLsizeiptr)(chunk * sizeof(AnalyticParticleSeed)), seeds.data() + emit_cursor);
+        emitted += chunk;
+        emit_cursor = (emit_cursor + chunk) % capacity;
     }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-    glBufferSubData(GL_ARRAY_BUFFER, 0, vert_data_len, vert_data);
+void AnalyticParticleSystem::rebase_time() {
+    for (AnalyticParticleSeed &seed : seeds) {
+        if (time - seed.emit_time < seed.lifetime) {
+            seed.emit_time -= time;
+        } else {
+            seed.emit_time = 0.0f; // Dead ones are cleared, or they'd come back once time catches up
+            seed.lifetime = 0.0f;
+        }
+    }
+    time = 0.0f;
 
+    glBindBuffer(GL_ARRAY_BUFFER, seed_buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr)(capacity * sizeof(AnalyticParticleSeed)), seeds.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void AnalyticParticleSystem::draw(f32 dt) {
+    time += dt;
+    if (time > ANALYTIC_PARTICLE_REBASE_TIME) {
+        rebase_time(); // One upload of the ring a minute, the deltas in the shader stay small
+    }
+
+    std::shared_ptr<Shader> shader_pin = shader.lock();
+    shader_pin->set_f32("u_time", time);
+    shader_pin->set_f32("u_size", size);
+
+    glBindVertexArray(vao);
+    glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, texture);
-    shader->set_f32("u_alpha", ps.transparency);
-    glDrawElements(GL_TRIANGLES, (GLsizeiptr)index_count, GL_UNSIGNED_INT, 0);
+    glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, 4, (GLsizei)capacity);
 }
@@ -1,11 +1,16 @@
 #include <cstdio>
 #include <string>
 #include <cassert>
+#include <cmath>
+#include <cstring>
 #include <utility>
+#include <chrono>
 #include "sfx_p.h"
 
-Sfx::Sfx(std::vector<SfxAsset> assets) {
-    player = std::make_unique<SfxPlayer>(assets);
+Sfx::Sfx(std::vector<SfxAsset> assets, const SfxSettings &settings)
+    : is_headless(settings.output == SfxOutput::MixerWav || settings.output == SfxOutput::MixerNull),
+      render_frames(0.0) {
+    thread = std::make_unique<SfxThread>(assets, settings);
 }
 
 Sfx::~Sfx() {
@@ -15,7 +20,200 @@ Sfx::~Sfx() {
 }
 
 void Sfx::play(SfxId id) {
-    player->play(id);
+    SfxCommand command;
+    command.type = SfxCommandType::Play;
+    command.id = id;
+    command.issue_ns = sfx_now_ns();
+    command.stream_index = 0;
+    command.frame_count = 0;
+    if (!thread->commands.push(command)) {
+        printf("Sfx command ring full, dropping a sound\n");
+    }
+}
+
+void Sfx::advance(f32 dt) {
+    if (!is_headless) {
+        return; // The device keeps its own time
+    }
+
+    // The part of a frame that's left is carried over, so the output is as long as the game ran
+    render_frames += (double)dt * MIXER_SAMPLE_RATE;
+    const u32 frame_count = (u32)render_frames;
+    render_frames -= frame_count;
+    if (frame_count == 0) {
+        return;
+    }
+
+    SfxCommand command;
+    command.type = SfxCommandType::Render;
+    command.id = SfxId::Count;
+    command.issue_ns = 0;
+    command.stream_index = 0;
+    command.frame_count = frame_count;
+    if (!thread->commands.push(command)) {
+        printf("Sfx command ring full, dropping %u frames of output\n", frame_count);
+    }
+}
+
+void Sfx::dump_latency() {
+    SfxCommand command;
+    command.type = SfxCommandType::LatencyDump;
+    command.id = SfxId::Count;
+    command.issue_ns = 0;
+    command.stream_index = 0;
+    command.frame_count = 0;
+    thread->commands.push(command);
+}
+
+sfx_stream_handle Sfx::stream_open(const std::string &file_name, bool is_looping) {
+    assert(thread->stream_count < SFX_STREAM_COUNT);
+    const u32 index = thread->stream_count++;
+    thread->stream_files[index] = file_name;
+    thread->stream_is_looping[index] = is_looping;
+    return index;
+}
+
+void Sfx::stream_play(sfx_stream_handle stream) {
+    SfxCommand command;
+    command.type = SfxCommandType::StreamPlay;
+    command.id = SfxId::Count;
+    command.issue_ns = 0;
+    command.stream_index = stream;
+    command.frame_count = 0;
+    thread->commands.push(command);
+}
+
+void Sfx::stream_stop(sfx_stream_handle stream) {
+    SfxCommand command;
+    command.type = SfxCommandType::StreamStop;
+    command.id = SfxId::Count;
+    command.issue_ns = 0;
+    command.stream_index = stream;
+    command.frame_count = 0;
+    thread->commands.push(command);
+}
+
+bool Sfx::encode_adpcm_wav(const std::string &in_file_name, const std::string &out_file_name) {
+    MappedFile in_file = Util::map_file(in_file_name.c_str());
+    if (!in_file.data) {
+        printf("Can't open %s\n", in_file_name.c_str());
+        return false;
+    }
+
+    WavInfo wav;
+    if (!wav_parse(in_file.data, in_file.size, wav) || wav.audio_format == WAV_FORMAT_IMA_ADPCM) {
+        printf("Can't encode %s, not a PCM wav\n", in_file_name.c_str());
+        Util::unmap_file(in_file);
+        return false;
+    }
+
+    // Through the mixer's loader, it already widens 8 bit to 16
+    const MixerSound pcm(wav.data, wav.data_size, wav.channel_count, wav.bits_per_sample);
+    Util::unmap_file(in_file);
+    if (pcm.frame_count == 0) {
+        printf("Can't encode %s, it's empty\n", in_file_name.c_str());
+        return false;
+    }
+    const std::vector<u8> blocks = adpcm_encode(pcm.samples.data(), pcm.frame_count, pcm.channel_count);
+
+    FILE *out_file = fopen(out_file_name.c_str(), "wb");
+    if (!out_file) {
+        printf("Can't open %s for writing\n", out_file_name.c_str());
+        return false;
+    }
+
+    const u16 audio_format = WAV_FORMAT_IMA_ADPCM;
+    const u16 channel_count = pcm.channel_count;
+    const u16 block_align = (u16)(ADPCM_BLOCK_BYTES_PER_CHANNEL * channel_count);
+    const u16 frames_per_block = (u16)adpcm_frames_per_block(block_align, channel_count);
+    const u32 byte_rate = wav.sample_freq * block_align / frames_per_block;
+    const u16 bits_per_sample = 4;
+    const u16 extra_size = 2; // Just frames_per_block after the usual fmt fields
+    const u32 fmt_size = 20;
+    const u32 fact_size = 4;
+    const u32 data_size = (u32)blocks.size();
+    const u32 riff_size = 4 + (8 + fmt_size) + (8 + fact_size) + (8 + data_size);
+
+    fwrite("RIFF", 1, 4, out_file);
+    fwrite(&riff_size, 4, 1, out_file);
+    fwrite("WAVEfmt ", 1, 8, out_file);
+    fwrite(&fmt_size, 4, 1, out_file);
+    fwrite(&audio_format, 2, 1, out_file);
+    fwrite(&channel_count, 2, 1, out_file);
+    fwrite(&wav.sample_freq, 4, 1, out_file);
+    fwrite(&byte_rate, 4, 1, out_file);
+    fwrite(&block_align, 2, 1, out_file);
+    fwrite(&bits_per_sample, 2, 1, out_file);
+    fwrite(&extra_size, 2, 1, out_file);
+    fwrite(&frames_per_block, 2, 1, out_file);
+    fwrite("fact", 1, 4, out_file);
+    fwrite(&fact_size, 4, 1, out_file);
+    fwrite(&pcm.frame_count, 4, 1, out_file); // The real length, the last block is padded
+    fwrite("data", 1, 4, out_file);
+    fwrite(&data_size, 4, 1, out_file);
+    fwrite(blocks.data(), 1, blocks.size(), out_file);
+    fclose(out_file);
+
+    printf("%s: %u frames, %u bytes of PCM to %u of ADPCM\n", out_file_name.c_str(), pcm.frame_count,
+           wav.data_size, data_size);
+    return true;
+}
+
+SfxThread::SfxThread(std::vector<SfxAsset> assets, SfxSettings settings)
+    : is_running(true), assets(std::move(assets)), settings(std::move(settings)), stream_count(0) {
+    thread = std::thread(&SfxThread::run, this);
+}
+
+SfxThread::~SfxThread() {
+    is_running.store(false, std::memory_order_release);
+    thread.join();
+}
+
+void SfxThread::run() {
+    // Commands pushed while this loads just wait in the ring
+    SfxPlayer player(assets, settings);
+
+    while (is_running.load(std::memory_order_acquire)) {
+        const bool did_work = drain(player);
+
+        player.streams_service();
+        player.mixer_service();
+        player.latency_service();
+
+        if (!did_work) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(SFX_THREAD_SLEEP_MS));
+        }
+    }
+
+    // Whatever was pushed before the stop, so a rendered file has all the frames the game asked for
+    drain(player);
+}
+
+bool SfxThread::drain(SfxPlayer &player) {
+    SfxCommand command;
+    bool did_work = false;
+    while (commands.pop(command)) {
+        did_work = true;
+        switch (command.type) {
+        case SfxCommandType::Play:
+            player.play(command.id, command.issue_ns);
+            break;
+        case SfxCommandType::StreamPlay:
+            player.stream_start(command.stream_index, stream_files[command.stream_index],
+                                stream_is_looping[command.stream_index]);
+            break;
+        case SfxCommandType::StreamStop:
+            player.stream_stop(command.stream_index);
+            break;
+        case SfxCommandType::LatencyDump:
+            player.latency_dump(assets);
+            break;
+        case SfxCommandType::Render:
+            player.render(command.frame_count);
+            break;
+        }
+    }
+    return did_work;
 }
 
 void SfxPlayer::check_al_error(const std::string &msg) {
@@ -25,35 +223,100 @@ void SfxPlayer::check_al_error(const std::string &msg) {
     }
 }
 
-SfxPlayer::SfxPlayer(std::vector<SfxAsset> assets) {
+SfxPlayer::SfxPlayer(std::vector<SfxAsset> assets, const SfxSettings &settings)
+    : device(nullptr), context(nullptr), output(settings.output),
+      has_device(settings.output == SfxOutput::Voices || settings.output == SfxOutput::Mixer),
+      first_free_voice(SFX_NO_VOICE), play_count(0), has_ima4(false) {
+    memset(voices, 0, sizeof(voices)); // Never touched without a device, they have no sources then
+    memset(sounds, 0, sizeof(sounds));
+    memset(streams, 0, sizeof(streams));
+    memset(latency, 0, sizeof(latency));
 #ifndef SFX_DISABLED
-    const char *default_device_name = alcGetString(nullptr, ALC_DEFAULT_DEVICE_SPECIFIER);
-    device = alcOpenDevice(default_device_name);
-    context = alcCreateContext(device, NULL);
-    alcMakeContextCurrent(context);
+    if (has_device) {
+        const char *default_device_name = alcGetString(nullptr, ALC_DEFAULT_DEVICE_SPECIFIER);
+        device = alcOpenDevice(default_device_name);
+        context = alcCreateContext(device, NULL);
+        alcMakeContextCurrent(context);
+        has_ima4 = alIsExtensionPresent("AL_EXT_IMA4") && alIsExtensionPresent("AL_SOFT_block_alignment");
 
-    source_startgame = create_source();
-    source_gameover = create_source();
-    source_objects = create_source();
+        first_free_voice = 0;
+        for (i32 i = 0; i < SFX_VOICE_COUNT; i++) {
+            SfxVoice &voice = voices[i];
+            voice.source = create_source();
+            voice.priority = 0;
+            voice.gain = 0.0f;
+            voice.start_order = 0;
+            voice.next_free = i + 1 < SFX_VOICE_COUNT ? i + 1 : SFX_NO_VOICE;
+            voice.is_active = false;
+            voice.id = SfxId::Count;
+            voice.issue_ns = 0;
+            voice.is_awaiting_output = false;
+        }
+
+        for (SfxStream &stream : streams) {
+            stream.source = create_source();
+            alGenBuffers(SFX_STREAM_BUFFER_COUNT, stream.buffers);
+        }
+    }
 
-    buffers.reserve(assets.size());
+    // Each sound is loaded for whichever side plays it, not both
+    const bool is_mixed = output != SfxOutput::Voices;
     for (const SfxAsset &asset : assets) {
-        sfx_buffer_handle handle = create_buffer_with_file(asset.file_name);
-        auto pair = std::make_pair(asset.id, handle);
-        buffers.insert(pair);
+        SfxSound &sound = sounds[(usize)asset.id];
+        sound.priority = asset.priority;
+        sound.gain = asset.gain;
+        if (is_mixed) {
+            mixer_sounds[(usize)asset.id] = create_mixer_sound_with_file(asset.file_name);
+            continue;
+        }
+
+        sound.buffer = create_buffer_with_file(asset.file_name);
+        if (sound.buffer != 0) {
+            ALint sample_freq;
+            alGetBufferi(sound.buffer, AL_FREQUENCY, &sample_freq);
+            sound.sample_freq = (u32)sample_freq;
+        }
     }
 
+    if (is_mixed) {
+        mixer = std::make_unique<Mixer>();
+        switch (output) {
+        case SfxOutput::Mixer:
+            mixer_sink = std::make_unique<SfxMixerSink>();
+            break;
+        case SfxOutput::MixerWav:
+            mixer_sink = std::make_unique<MixerWavSink>(settings.wav_file_name.c_str());
+            break;
+        default:
+            mixer_sink = std::make_unique<MixerNullSink>();
+            break;
+        }
+    }
 #endif
 }
 
 SfxPlayer::~SfxPlayer() {
 #ifndef SFX_DISABLED
-    alDeleteSources(1, &(source_startgame));
-    alDeleteSources(1, &(source_gameover));
-    alDeleteSources(1, &(source_objects));
+    mixer_sink.reset(); // Before the context goes. The WAV one writes its header here
+    if (!has_device) {
+        return;
+    }
+
+    for (SfxVoice &voice : voices) {
+        alSourceStop(voice.source);
+        alDeleteSources(1, &(voice.source));
+    }
 
-    for (const auto &pair : buffers) {
-        alDeleteBuffers(1, &pair.second);
+    for (const SfxSound &sound : sounds) {
+        if (sound.buffer != 0) {
+            alDeleteBuffers(1, &sound.buffer);
+        }
+    }
+
+    for (u32 i = 0; i < SFX_STREAM_COUNT; i++) {
+        stream_stop(i);
+        alDeleteSources(1, &(streams[i].source));
+        alDeleteBuffers(SFX_STREAM_BUFFER_COUNT, streams[i].buffers);
     }
 
     device = alcGetContextsDevice(context);
@@ -63,30 +326,145 @@ SfxPlayer::~SfxPlayer() {
 #endif
 }
 
+ALenum sfx_al_format(u16 channel_count, u16 bits_per_sample) {
+    if (channel_count == 2) {
+        return bits_per_sample == 8 ? AL_FORMAT_STEREO8 : AL_FORMAT_STEREO16;
+    }
+    return bits_per_sample == 8 ? AL_FORMAT_MONO8 : AL_FORMAT_MONO16;
+}
+
+static u32 read_u32(const u8 *bytes) {
+    u32 value;
+    memcpy(&value, bytes, sizeof(value)); // Unaligned, and RIFF is little endian like every target of ours
+    return value;
+}
+
+static u16 read_u16(const u8 *bytes) {
+    u16 value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+bool wav_parse(const u8 *bytes, usize size, WavInfo &out_info) {
+    if (size < 12 || memcmp(bytes, "RIFF", 4) != 0 || memcmp(bytes + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+
+    bool has_fmt = false;
+    u32 fact_frame_count = 0;
+    bool has_fact = false;
+    usize offset = 12;
+    while (offset + 8 <= size) {
+        const u8 *chunk_id = bytes + offset;
+        const u32 chunk_size = read_u32(bytes + offset + 4);
+        const u8 *body = bytes + offset + 8;
+        const usize body_available = size - offset - 8;
+
+        if (memcmp(chunk_id, "fmt ", 4) == 0 && chunk_size >= 16 && body_available >= 16) {
+            out_info.audio_format = read_u16(body);
+            out_info.channel_count = read_u16(body + 2);
+            out_info.sample_freq = read_u32(body + 4);
+            out_info.block_align = read_u16(body + 12);
+            out_info.bits_per_sample = read_u16(body + 14);
+            has_fmt = true;
+        } else if (memcmp(chunk_id, "fact", 4) == 0 && chunk_size >= 4 && body_available >= 4) {
+            fact_frame_count = read_u32(body);
+            has_fact = true;
+        } else if (memcmp(chunk_id, "data", 4) == 0) {
+            // PCM only as OpenAL takes it without extensions: 8/16 bit. ADPCM gets decoded by us
+            const u16 channel_count = out_info.channel_count;
+            const u16 block_align = out_info.block_align;
+            const bool is_pcm = (out_info.audio_format == WAV_FORMAT_PCM ||
+                                 out_info.audio_format == WAV_FORMAT_EXTENSIBLE) &&
+                                (out_info.bits_per_sample == 8 || out_info.bits_per_sample == 16);
+            const bool is_adpcm = out_info.audio_format == WAV_FORMAT_IMA_ADPCM &&
+                                  out_info.bits_per_sample == 4 && block_align > 4 * channel_count &&
+                                  block_align % (4 * channel_count) == 0;
+            const bool is_supported = (channel_count == 1 || channel_count == 2) && block_align != 0;
+            if (!has_fmt || !(is_pcm || is_adpcm) || !is_supported) {
+                return false;
+            }
+            out_info.data = body;
+            out_info.data_size = chunk_size < body_available ? chunk_size : (u32)body_available; // Truncated
+            out_info.data_size -= out_info.data_size % block_align; // Whole frames or blocks only
+            if (is_adpcm) {
+                const u32 frames_per_block = adpcm_frames_per_block(block_align, channel_count);
+                out_info.frame_count = out_info.data_size / block_align * frames_per_block;
+                if (has_fact && fact_frame_count < out_info.frame_count) {
+                    out_info.frame_count = fact_frame_count;
+                }
+            } else {
+                out_info.frame_count = out_info.data_size / block_align;
+            }
+            return true;
+        }
+
+        offset += 8 + chunk_size + (chunk_size & 1); // Chunks are padded to an even size
+    }
+
+    return false;
+}
+
 sfx_buffer_handle SfxPlayer::create_buffer_with_file(const std::string &file_name) {
-    WavHeader wav_header;
-    usize wav_header_size = sizeof(WavHeader);
-    FILE *wav_file = fopen(file_name.c_str(), "r");
-    assert(wav_file);
-    fread(&wav_header, 1, wav_header_size, wav_file);
+    MappedFile file = Util::map_file(file_name.c_str());
+    assert(file.data);
 
-    u8 *wav_buffer = (u8 *)malloc(wav_header.sample_data_len);
-    fseek(wav_file, 44, SEEK_SET);
-    fread(wav_buffer, wav_header.sample_data_len, 1, wav_file);
+    WavInfo wav;
+    if (!wav_parse(file.data, file.size, wav)) {
+        printf("Can't load %s, not a PCM wav\n", file_name.c_str());
+        Util::unmap_file(file);
+        return 0;
+    }
 
+    // Straight from the mapping, OpenAL makes its own copy
     sfx_buffer_handle buffer_handle;
     alGenBuffers(1, &buffer_handle);
-    alBufferData(buffer_handle, AL_FORMAT_MONO16, wav_buffer, (ALsizei)wav_header.sample_data_len,
-                 (ALsizei)wav_header.sample_freq);
+    if (wav.audio_format != WAV_FORMAT_IMA_ADPCM) {
+        alBufferData(buffer_handle, sfx_al_format(wav.channel_count, wav.bits_per_sample), wav.data,
+                     (ALsizei)wav.data_size, (ALsizei)wav.sample_freq);
+    } else if (has_ima4) {
+        // Kept compressed. The padding at the end of the last block gets played, it's the last frame held
+        // for at most one block
+        const ALenum format = wav.channel_count == 2 ? SFX_AL_FORMAT_STEREO_IMA4 : SFX_AL_FORMAT_MONO_IMA4;
+        alBufferi(buffer_handle, SFX_AL_UNPACK_BLOCK_ALIGNMENT_SOFT,
+                  (ALint)adpcm_frames_per_block(wav.block_align, wav.channel_count));
+        alBufferData(buffer_handle, format, wav.data, (ALsizei)wav.data_size, (ALsizei)wav.sample_freq);
+    } else {
+        const i16 *frames = pcm_pool_decode(wav, 0, wav.data_size / wav.block_align);
+        alBufferData(buffer_handle, sfx_al_format(wav.channel_count, 16), frames,
+                     (ALsizei)(wav.frame_count * wav.channel_count * sizeof(i16)), (ALsizei)wav.sample_freq);
+    }
 
-    free(wav_buffer);
-    fclose(wav_file);
+    Util::unmap_file(file);
 
     SfxPlayer::check_al_error("buffer created with file");
 
     return buffer_handle;
 }
 
+std::unique_ptr<MixerSound> SfxPlayer::create_mixer_sound_with_file(const std::string &file_name) {
+    MappedFile file = Util::map_file(file_name.c_str());
+    assert(file.data);
+
+    WavInfo wav;
+    std::unique_ptr<MixerSound> sound;
+    if (!wav_parse(file.data, file.size, wav)) {
+        printf("Can't load %s, not a PCM wav\n", file_name.c_str());
+    } else if (wav.sample_freq != MIXER_SAMPLE_RATE) {
+        printf("Can't mix %s, it's %uHz and the mixer doesn't resample\n", file_name.c_str(),
+               wav.sample_freq);
+    } else if (wav.audio_format == WAV_FORMAT_IMA_ADPCM) {
+        const i16 *frames = pcm_pool_decode(wav, 0, wav.data_size / wav.block_align);
+        sound = std::make_unique<MixerSound>((const u8 *)frames, wav.frame_count * wav.channel_count * 2,
+                                             wav.channel_count, (u16)16);
+    } else {
+        sound = std::make_unique<MixerSound>(wav.data, wav.data_size, wav.channel_count, wav.bits_per_sample);
+    }
+
+    Util::unmap_file(file);
+    return sound;
+}
+
 sfx_source_handle SfxPlayer::create_source() {
     sfx_source_handle source_handle;
     alGenSources((ALuint)1, &source_handle);
@@ -100,45 +478,387 @@ sfx_source_handle SfxPlayer::create_source() {
     return source_handle;
 }
 
-void SfxPlayer::play(SfxId id) {
+void SfxPlayer::voices_reclaim() {
+    for (i32 i = 0; i < SFX_VOICE_COUNT; i++) {
+        SfxVoice &voice = voices[i];
+        if (!voice.is_active) {
+            continue;
+        }
 
-#ifndef SFX_DISABLED
-    if (buffers.find(id) == buffers.end()) {
+        ALint source_state;
+        alGetSourcei(voice.source, AL_SOURCE_STATE, &source_state);
+        if (source_state != AL_PLAYING) {
+            voice.is_active = false;
+            voice.next_free = first_free_voice;
+            first_free_voice = i;
+        }
+    }
+}
+
+i32 SfxPlayer::voice_allocate(u32 priority, f32 gain) {
+    // Finished voices are only looked for when the free list runs out, not on every play
+    if (first_free_voice == SFX_NO_VOICE) {
+        voices_reclaim();
+    }
+
+    if (first_free_voice != SFX_NO_VOICE) {
+        const i32 index = first_free_voice;
+        first_free_voice = voices[index].next_free;
+        return index;
+    }
+
+    // All busy. Steal the least important one: lowest priority, then quietest, then oldest
+    i32 victim = SFX_NO_VOICE;
+    for (i32 i = 0; i < SFX_VOICE_COUNT; i++) {
+        const SfxVoice &voice = voices[i];
+        if (voice.priority > priority || (voice.priority == priority && voice.gain > gain)) {
+            continue; // Never for something less important, or as important but quieter, than what's playing
+        }
+
+        if (victim == SFX_NO_VOICE) {
+            victim = i;
+            continue;
+        }
+
+        const SfxVoice &best = voices[victim];
+        if (voice.priority != best.priority) {
+            victim = voice.priority < best.priority ? i : victim;
+        } else if (voice.gain != best.gain) {
+            victim = voice.gain < best.gain ? i : victim;
+        } else if (voice.start_order < best.start_order) {
+            victim = i;
+        }
+    }
+
+    if (victim != SFX_NO_VOICE) {
+        alSourceStop(voices[victim].source);
+    }
+    return victim;
+}
+
+void SfxPlayer::play(SfxId id, u64 issue_ns) {
+    const SfxSound &sound = sounds[(usize)id];
+    SfxLatencyHistogram &start_latency = latency[(usize)id][(usize)SfxLatencyStage::Start];
+    if (mixer) {
+        // Only the start is measured here, the output side would need the sink's queue position
+        const MixerSound *mixer_sound = mixer_sounds[(usize)id].get();
+        if (mixer_sound != nullptr) {
+            mixer->play(*mixer_sound, sound.gain, 0.0f);
+            start_latency.add(sfx_now_ns() - issue_ns);
+        }
+        return;
+    }
+
+    if (sound.buffer == 0) {
         printf("Can't play sound. Unrecognized id: %d\n", id);
         return;
     }
 
-    sfx_buffer_handle buffer = buffers[id];
-
-    sfx_source_handle source = 0;
-    switch (id) {
-    case SfxId::SfxStart:
-        source = source_startgame;
-        break;
-    case SfxId::SfxGameOver:
-        source = source_gameover;
-        break;
-    case SfxId::SfxHitPad:
-    case SfxId::SfxHitWall:
-        source = source_objects;
-        break;
-    default:
-        printf("Unable to play sfx. Unrecognized id: %d\n", id);
+    const i32 voice_index = play(sound.buffer, sound.priority, sound.gain);
+    if (voice_index == SFX_NO_VOICE) {
         return;
     }
+    start_latency.add(sfx_now_ns() - issue_ns);
+
+    SfxVoice &voice = voices[voice_index];
+    voice.id = id;
+    voice.issue_ns = issue_ns;
+    voice.is_awaiting_output = true;
+}
+
+i32 SfxPlayer::play(sfx_buffer_handle buffer, u32 priority, f32 gain) {
+
+#ifndef SFX_DISABLED
+    const i32 voice_index = voice_allocate(priority, gain);
+    if (voice_index == SFX_NO_VOICE) {
+        return SFX_NO_VOICE; // Everything playing is more important
+    }
+
+    SfxVoice &voice = voices[voice_index];
+    voice.priority = priority;
+    voice.gain = gain;
+    voice.start_order = play_count++;
+    voice.is_active = true;
+    voice.is_awaiting_output = false; // Might have been stolen before it got there
 
-    alSourcei(source, AL_BUFFER, (ALint)buffer);
+    alSourcei(voice.source, AL_BUFFER, (ALint)buffer);
+    alSourcef(voice.source, AL_GAIN, gain);
     SfxPlayer::check_al_error("source");
-    alSourcePlay(source);
+    alSourcePlay(voice.source);
     SfxPlayer::check_al_error("source play");
+    return voice_index;
+#else
+    return SFX_NO_VOICE;
+#endif
+}
+
+void SfxPlayer::stream_start(u32 index, const std::string &file_name, bool is_looping) {
+#ifndef SFX_DISABLED
+    if (!has_device) {
+        printf("Can't stream %s, the output has no audio device\n", file_name.c_str());
+        return;
+    }
+    stream_stop(index); // Starting again is from the top
+
+    SfxStream &stream = streams[index];
+    stream.file = Util::map_file(file_name.c_str());
+    if (!stream.file.data) {
+        printf("Can't stream %s\n", file_name.c_str());
+        return;
+    }
+    if (!wav_parse(stream.file.data, stream.file.size, stream.wav)) {
+        printf("Can't stream %s, not a PCM wav\n", file_name.c_str());
+        Util::unmap_file(stream.file);
+        return;
+    }
+
+    stream.cursor = 0;
+    stream.format = sfx_al_format(stream.wav.channel_count, stream.wav.bits_per_sample);
+    stream.is_looping = is_looping;
+    stream.is_active = true;
+
+    // Everything queued up front, then each one is refilled as it's played
+    u32 queued_count = 0;
+    while (queued_count < SFX_STREAM_BUFFER_COUNT && stream_fill(stream, stream.buffers[queued_count])) {
+        queued_count++;
+    }
+    alSourceQueueBuffers(stream.source, (ALsizei)queued_count, stream.buffers);
+    alSourcePlay(stream.source);
+    SfxPlayer::check_al_error("stream start");
+#endif
+}
+
+void SfxPlayer::stream_stop(u32 index) {
+    SfxStream &stream = streams[index];
+    if (!stream.is_active) {
+        return;
+    }
+
+    alSourceStop(stream.source);
+    alSourcei(stream.source, AL_BUFFER, 0); // Unqueues everything
+    Util::unmap_file(stream.file);
+    stream.is_active = false;
+}
+
+bool SfxPlayer::stream_fill(SfxStream &stream, sfx_buffer_handle buffer) {
+    if (stream.cursor == stream.wav.data_size) {
+        if (!stream.is_looping || stream.wav.data_size == 0) {
+            return false;
+        }
+        stream.cursor = 0; // The buffer before this one might have been short, it ended at the end
+    }
+
+    if (stream.wav.audio_format == WAV_FORMAT_IMA_ADPCM) {
+        // Decoded just in time, a chunk's worth of whole blocks
+        const WavInfo &wav = stream.wav;
+        const u32 frames_per_block = adpcm_frames_per_block(wav.block_align, wav.channel_count);
+        const u32 block_bytes = frames_per_block * wav.channel_count * (u32)sizeof(i16); // Decoded
+        const u32 max_block_count = SFX_STREAM_CHUNK_BYTES / block_bytes;
+        const u32 first_block = stream.cursor / wav.block_align;
+        u32 block_count = (wav.data_size - stream.cursor) / wav.block_align;
+        block_count = block_count < max_block_count ? block_count : max_block_count;
+
+        // The padding in the last block is cut off
+        const u32 first_frame = first_block * frames_per_block;
+        const u32 frames_left = wav.frame_count > first_frame ? wav.frame_count - first_frame : 0;
+        u32 frame_count = block_count * frames_per_block;
+        frame_count = frame_count < frames_left ? frame_count : frames_left;
+
+        const i16 *frames = pcm_pool_decode(wav, first_block, block_count);
+        alBufferData(buffer, stream.format, frames, (ALsizei)(frame_count * wav.channel_count * sizeof(i16)),
+                     (ALsizei)wav.sample_freq);
+        stream.cursor += block_count * wav.block_align;
+        return true;
+    }
+
+    // Whole frames, since the chunk size is a multiple of every block_align we take
+    u32 chunk_size = stream.wav.data_size - stream.cursor;
+    chunk_size = chunk_size < SFX_STREAM_CHUNK_BYTES ? chunk_size : SFX_STREAM_CHUNK_BYTES;
+
+    alBufferData(buffer, stream.format, stream.wav.data + stream.cursor, (ALsizei)chunk_size,
+                 (ALsizei)stream.wav.sample_freq);
+    stream.cursor += chunk_size;
+    return true;
+}
+
+const i16 *SfxPlayer::pcm_pool_decode(const WavInfo &wav, u32 first_block, u32 block_count) {
+    const u32 frames_per_block = adpcm_frames_per_block(wav.block_align, wav.channel_count);
+    const usize sample_count = (usize)block_count * frames_per_block * wav.channel_count;
+    if (pcm_pool.size() < sample_count) {
+        pcm_pool.resize(sample_count); // Grows to the biggest sound, then stays
+    }
+    adpcm_decode(wav.data + (usize)first_block * wav.block_align, block_count, wav.block_align,
+                 wav.channel_count, pcm_pool.data());
+    return pcm_pool.data();
+}
+
+void SfxPlayer::streams_service() {
+#ifndef SFX_DISABLED
+    for (u32 i = 0; i < SFX_STREAM_COUNT; i++) {
+        SfxStream &stream = streams[i];
+        if (!stream.is_active) {
+            continue;
+        }
+
+        ALint processed_count;
+        alGetSourcei(stream.source, AL_BUFFERS_PROCESSED, &processed_count);
+        for (ALint processed = 0; processed < processed_count; processed++) {
+            sfx_buffer_handle buffer;
+            alSourceUnqueueBuffers(stream.source, 1, &buffer);
+            if (stream_fill(stream, buffer)) {
+                alSourceQueueBuffers(stream.source, 1, &buffer);
+            }
+        }
+
+        ALint queued_count;
+        ALint source_state;
+        alGetSourcei(stream.source, AL_BUFFERS_QUEUED, &queued_count);
+        alGetSourcei(stream.source, AL_SOURCE_STATE, &source_state);
+        if (queued_count == 0) {
+            stream_stop(i); // Played to the end
+        } else if (source_state != AL_PLAYING) {
+            alSourcePlay(stream.source); // Ran dry before we got to it, the source stops by itself then
+        }
+    }
+#endif
+}
+
+void SfxPlayer::mixer_service() {
+    if (mixer) {
+        mixer->service(*mixer_sink);
+    }
+}
+
+void SfxPlayer::render(u32 frame_count) {
+    if (mixer && !has_device) {
+        mixer->render(*mixer_sink, frame_count);
+    }
+}
+
+SfxMixerSink::SfxMixerSink() : unqueued_count(SFX_MIXER_BUFFER_COUNT) {
+    source = SfxPlayer::create_source();
+    alSourcef(source, AL_GAIN, 1.0f); // The gains are applied in the mix
+    alGenBuffers(SFX_MIXER_BUFFER_COUNT, buffers);
+}
+
+SfxMixerSink::~SfxMixerSink() {
+    alSourceStop(source);
+    alSourcei(source, AL_BUFFER, 0);
+    alDeleteSources(1, &source);
+    alDeleteBuffers(SFX_MIXER_BUFFER_COUNT, buffers);
+}
+
+u32 SfxMixerSink::blocks_wanted() {
+    ALint processed_count;
+    alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed_count);
+    return unqueued_count + (u32)processed_count;
+}
+
+void SfxMixerSink::write(const i16 *frames, u32 frame_count) {
+    sfx_buffer_handle buffer;
+    if (unqueued_count > 0) {
+        buffer = buffers[SFX_MIXER_BUFFER_COUNT - unqueued_count--];
+    } else {
+        alSourceUnqueueBuffers(source, 1, &buffer);
+    }
+
+    const ALsizei byte_count = (ALsizei)(frame_count * MIXER_CHANNEL_COUNT * sizeof(i16));
+    alBufferData(buffer, AL_FORMAT_STEREO16, frames, byte_count, MIXER_SAMPLE_RATE);
+    alSourceQueueBuffers(source, 1, &buffer);
+
+    ALint source_state;
+    alGetSourcei(source, AL_SOURCE_STATE, &source_state);
+    if (source_state != AL_PLAYING) {
+        alSourcePlay(source); // First block, or it ran dry
+    }
+    SfxPlayer::check_al_error("mixer sink write");
+}
+
+u64 sfx_now_ns() {
+    return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+void SfxLatencyHistogram::add(u64 latency_ns) {
+    const u64 latency_us = latency_ns / 1000;
+    u32 bucket = 0;
+    while (bucket + 1 < SFX_LATENCY_BUCKET_COUNT && (latency_us >> (bucket + 1)) != 0) {
+        bucket++;
+    }
+    buckets[bucket]++;
+    count++;
+    total_us += latency_us;
+    max_us = latency_us > max_us ? latency_us : max_us;
+}
+
+u64 SfxLatencyHistogram::percentile_us(f32 fraction) const {
+    const u32 target = (u32)ceilf((f32)count * fraction);
+    u32 seen = 0;
+    for (u32 i = 0; i < SFX_LATENCY_BUCKET_COUNT; i++) {
+        seen += buckets[i];
+        if (seen >= target) {
+            return i + 1 < SFX_LATENCY_BUCKET_COUNT ? 2ull << i : max_us; // The last one has no upper edge
+        }
+    }
+    return max_us;
+}
+
+void SfxPlayer::latency_service() {
+#ifndef SFX_DISABLED
+    // Only the voices ever wait for output, the mixer doesn't measure it
+    const u64 now_ns = sfx_now_ns();
+    for (SfxVoice &voice : voices) {
+        if (!voice.is_awaiting_output) {
+            continue;
+        }
+
+        ALint source_state;
+        ALint sample_offset;
+        alGetSourcei(voice.source, AL_SOURCE_STATE, &source_state);
+        alGetSourcei(voice.source, AL_SAMPLE_OFFSET, &sample_offset);
+        if (source_state != AL_PLAYING) {
+            voice.is_awaiting_output = false; // Over before we looked, not counted
+            continue;
+        }
+        if (sample_offset == 0) {
+            continue; // Still in the queue on OpenAL's side
+        }
+
+        // The first sample went out sample_offset samples ago, so how late we poll doesn't matter
+        const u32 sample_freq = sounds[(usize)voice.id].sample_freq;
+        const u64 played_ns = (u64)sample_offset * 1000000000ull / sample_freq;
+        const u64 output_ns = now_ns > voice.issue_ns + played_ns ? now_ns - played_ns : voice.issue_ns;
+        latency[(usize)voice.id][(usize)SfxLatencyStage::Output].add(output_ns - voice.issue_ns);
+        voice.is_awaiting_output = false;
+    }
 #endif
+}
 
-    // Checking if the source is still playing:
-    // ALint source_state;
-    // alGetSourcei(sfx->source, AL_SOURCE_STATE, &source_state);
-    // while (source_state == AL_PLAYING)
-    // {
-    //     alGetSourcei(al_source, AL_SOURCE_STATE, &source_state);
-    //     check_al_error("source get 2");
-    // }
-}
\ No newline at end of file
+void SfxPlayer::latency_dump(const std::vector<SfxAsset> &assets) const {
+    static const char *stage_names[(usize)SfxLatencyStage::Count] = {"start", "output"};
+
+    printf("Sfx latency from Engine::sfx_play, in microseconds. Percentiles are bucket upper edges\n");
+    for (const SfxAsset &asset : assets) {
+        for (u32 stage = 0; stage < (u32)SfxLatencyStage::Count; stage++) {
+            const SfxLatencyHistogram &histogram = latency[(usize)asset.id][stage];
+            if (histogram.count == 0) {
+                continue;
+            }
+
+            const unsigned long long mean_us = histogram.total_us / histogram.count;
+            const unsigned long long p50_us = histogram.percentile_us(0.5f);
+            const unsigned long long p95_us = histogram.percentile_us(0.95f);
+            const unsigned long long max_us = histogram.max_us;
+            printf("%-24s %-6s n %5u mean %7llu p50 <%7llu p95 <%7llu max %7llu\n", asset.file_name.c_str(),
+                   stage_names[stage], histogram.count, mean_us, p50_us, p95_us, max_us);
+            printf("   ");
+            for (u32 i = 0; i < SFX_LATENCY_BUCKET_COUNT; i++) {
+                if (histogram.buckets[i] != 0) {
+                    printf(" <%lluus:%u", 2ull << i, histogram.buckets[i]);
+                }
+            }
+            printf("\n");
+        }
+    }
+}
@@ -4,6 +4,7 @@
 
 DISABLE_WARNINGS
 #include <string>
+#include <vector>
 #include <GL/glew.h>
 ENABLE_WARNINGS
 
@@ -11,7 +12,7 @@ ENABLE_WARNINGS
 #include "shader.h"
 #include "tomath.h"
 
-Shader::Shader(const std::string &file_path) {
+Shader::Shader(const std::string &file_path, const std::vector<const char *> &feedback_varyings) {
 
     char info_log[512]; // TODO @CLEANUP: Better logging
     const char *shader_string = (const char *)Util::read_file(file_path.c_str());
@@ -44,6 +45,10 @@ Shader::Shader(const std::string &file_path) {
     handle = glCreateProgram();
     glAttachShader(handle, vertex_shader_handle);
     glAttachShader(handle, frag_shader_handle);
+    if (!feedback_varyings.empty()) {
+        glTransformFeedbackVaryings(handle, (GLsizei)feedback_varyings.size(), feedback_varyings.data(),
+                                    GL_INTERLEAVED_ATTRIBS);
+    }
     glLinkProgram(handle);
     glGetProgramiv(handle, GL_LINK_STATUS, &success);
     if (!success) {
@@ -0,0 +1,36 @@
+#ifdef VERTEX
+
+layout(location = 0) in vec2 in_pos;
+layout(location = 1) in vec2 in_texcoord;
+layout(location = 2) in float in_alpha;
+
+uniform mat4 u_view;
+uniform mat4 u_proj;
+
+out vec2 v2f_texcoord;
+out float v2f_alpha;
+
+void main()
+{
+    // Particles are written in world space, no model matrix
+    v2f_texcoord = in_texcoord;
+    v2f_alpha = in_alpha;
+    gl_Position = u_proj * u_view * vec4(in_pos, 0.0, 1.0);
+}
+#endif
+
+#ifdef FRAGMENT
+
+in vec2 v2f_texcoord;
+in float v2f_alpha;
+layout(binding = 0) uniform sampler2D u_texture;
+
+out vec4 frag_color;
+
+void main()
+{
+    vec4 color = texture(u_texture, v2f_texcoord);
+    color.a = v2f_alpha;
+    frag_color = color;
+}
+#endif
@@ -0,0 +1,47 @@
+#ifdef VERTEX
+
+layout(location = 0) in vec2 in_corner;    // Per vertex, unit quad around the origin
+layout(location = 1) in vec2 in_emit_pos;  // Per instance, the rest too
+layout(location = 2) in vec2 in_vel;
+layout(location = 3) in vec2 in_time_life; // Emit time and lifetime
+
+uniform mat4 u_view;
+uniform mat4 u_proj;
+uniform float u_time;
+uniform float u_size;
+
+out vec2 v2f_texcoord;
+out float v2f_alpha;
+
+void main()
+{
+    float age = u_time - in_time_life.x;
+    float lifetime = in_time_life.y;
+    bool is_alive = age < lifetime;
+
+    // Straight line at a constant speed, so this is exactly what the CPU path would have integrated to
+    vec2 pos = in_emit_pos + in_vel * age;
+
+    // Dead ones collapse to a point, so they don't produce any pixels
+    float size = is_alive ? u_size : 0.0;
+    v2f_texcoord = in_corner + 0.5;
+    v2f_alpha = is_alive ? 1.0 - age / lifetime : 0.0;
+    gl_Position = u_proj * u_view * vec4(pos + in_corner * size, 0.0, 1.0);
+}
+#endif
+
+#ifdef FRAGMENT
+
+in vec2 v2f_texcoord;
+in float v2f_alpha;
+layout(binding = 0) uniform sampler2D u_texture;
+
+out vec4 frag_color;
+
+void main()
+{
+    vec4 color = texture(u_texture, v2f_texcoord);
+    color.a = v2f_alpha;
+    frag_color = color;
+}
+#endif
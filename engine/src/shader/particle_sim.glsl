@@ -0,0 +1,29 @@
+#ifdef VERTEX
+
+layout(location = 0) in vec2 in_pos;
+layout(location = 1) in vec2 in_vel;
+layout(location = 2) in vec2 in_age_life;
+
+uniform float u_dt;
+
+// Captured with transform feedback into the other state buffer
+out vec2 tf_pos;
+out vec2 tf_vel;
+out vec2 tf_age_life;
+
+void main()
+{
+    // Dead particles keep going too, they are just not drawn. Branching would cost more than it saves
+    tf_pos = in_pos + in_vel * u_dt;
+    tf_vel = in_vel;
+    tf_age_life = vec2(in_age_life.x + u_dt, in_age_life.y);
+}
+#endif
+
+#ifdef FRAGMENT
+
+// Never runs, the rasterizer is off during the simulation pass. The program wants a fragment stage though
+void main()
+{
+}
+#endif
@@ -1,26 +1,30 @@
 #ifdef VERTEX
 layout(location = 0) in vec2 u_pos;
-layout(location = 1) in vec2 u_texcoord;
+layout(location = 1) in vec3 u_texcoord; // z is the atlas page
 
-out vec2 v2f_texcoord;
+out vec3 v2f_texcoord;
 
 void main()
 {
-    v2f_texcoord = vec2(u_texcoord.x, u_texcoord.y);
+    v2f_texcoord = u_texcoord;
     gl_Position = vec4(u_pos, 0.0, 1.0);
 }
 #endif
 
 #ifdef FRAGMENT
-layout(binding = 0) uniform sampler2D u_texture_ui;
+layout(binding = 0) uniform sampler2DArray u_texture_ui;
 
-in vec2 v2f_texcoord;
+in vec3 v2f_texcoord;
 
 out vec4 out_color;
 
 void main()
 {
-    float texture_value = texture(u_texture_ui, vec2(v2f_texcoord.x, -v2f_texcoord.y)).r;
-    out_color = vec4(1, 1, 1, texture_value);
+    // The atlas holds distance fields, 0.5 is right on the outline. Smoothing over the screen space rate
+    // of change keeps the edge about a pixel wide whatever size the text is drawn at
+    float distance = texture(u_texture_ui, vec3(v2f_texcoord.x, -v2f_texcoord.y, v2f_texcoord.z)).r;
+    float edge_width = fwidth(distance);
+    float alpha = smoothstep(0.5 - edge_width, 0.5 + edge_width, distance);
+    out_color = vec4(1, 1, 1, alpha);
 }
 #endif
@@ -0,0 +1,121 @@
+#include "common.h"
+
+DISABLE_WARNINGS
+#include <cstring>
+ENABLE_WARNINGS
+
+#include "godata.h"
+#include "transform.h"
+
+TransformHierarchy::TransformHierarchy() : first_dirty(0), update_count(0) {
+}
+
+u32 TransformHierarchy::add_root(GoData &go) {
+    TransformNode node;
+    node.parent = TRANSFORM_NO_PARENT;
+    node.depth = 0;
+    node.handle = (u32)handle_to_index.size();
+    node.local = go.transform;
+    node.world = go.transform;
+    node.is_dirty = false;
+    node.changed_update = 0;
+    node.go = &go;
+
+    // Roots are depth 0, so they go right after the other roots
+    u32 index = 0;
+    while (index < nodes.size() && nodes[index].depth == 0) {
+        index++;
+    }
+
+    for (TransformNode &other : nodes) {
+        if (other.parent >= (i32)index) {
+            other.parent++;
+        }
+    }
+    nodes.insert(nodes.begin() + index, node);
+    handle_to_index.push_back(index);
+    for (u32 i = index; i < nodes.size(); i++) {
+        handle_to_index[nodes[i].handle] = i;
+    }
+
+    first_dirty = first_dirty < index ? first_dirty : index; // Everything after it just moved
+    return node.handle;
+}
+
+u32 TransformHierarchy::add_child(GoData &go, u32 parent_handle) {
+    const u32 parent_index = handle_to_index[parent_handle];
+
+    TransformNode node;
+    node.parent = (i32)parent_index;
+    node.depth = nodes[parent_index].depth + 1;
+    node.handle = (u32)handle_to_index.size();
+    node.local = nodes[parent_index].go->transform.inverse_affine() * go.transform;
+    node.world = go.transform;
+    node.is_dirty = true;
+    node.changed_update = 0;
+    node.go = &go;
+
+    // At the end of its depth, which is after the parent
+    u32 index = parent_index + 1;
+    while (index < nodes.size() && nodes[index].depth <= node.depth) {
+        index++;
+    }
+
+    for (TransformNode &other : nodes) {
+        if (other.parent >= (i32)index) {
+            other.parent++;
+        }
+    }
+    nodes.insert(nodes.begin() + index, node);
+    handle_to_index.push_back(index);
+    for (u32 i = index; i < nodes.size(); i++) {
+        handle_to_index[nodes[i].handle] = i;
+    }
+
+    first_dirty = first_dirty < index ? first_dirty : index;
+    return node.handle;
+}
+
+void TransformHierarchy::set_local(u32 handle, const Mat4 &local) {
+    const u32 index = handle_to_index[handle];
+    nodes[index].local = local;
+    nodes[index].is_dirty = true;
+    first_dirty = first_dirty < index ? first_dirty : index;
+}
+
+void TransformHierarchy::translate_local(u32 handle, Vec2 offset) {
+    const u32 index = handle_to_index[handle];
+    nodes[index].local.translate_xy(offset);
+    nodes[index].is_dirty = true;
+    first_dirty = first_dirty < index ? first_dirty : index;
+}
+
+void TransformHierarchy::update() {
+    // Stamped instead of a flag, so the nodes this pass skips don't need clearing
+    update_count++;
+
+    // Roots are all at the front. Gameplay moves them directly, so they're checked every time
+    u32 i = 0;
+    for (; i < nodes.size() && nodes[i].parent == TRANSFORM_NO_PARENT; i++) {
+        TransformNode &node = nodes[i];
+        if (memcmp(node.world.data, node.go->transform.data, sizeof(node.world.data)) != 0) {
+            node.world = node.go->transform;
+            node.changed_update = update_count;
+            first_dirty = first_dirty < i ? first_dirty : i;
+        }
+    }
+
+    for (i = first_dirty > i ? first_dirty : i; i < nodes.size(); i++) {
+        TransformNode &node = nodes[i];
+        if (!node.is_dirty && nodes[node.parent].changed_update != update_count) {
+            continue;
+        }
+
+        node.changed_update = update_count;
+        node.world = nodes[node.parent].world * node.local;
+        node.go->transform = node.world;
+        node.is_dirty = false;
+    }
+
+    first_dirty = (u32)nodes.size();
+}
@@ -0,0 +1,91 @@
+#include "common.h"
+
+DISABLE_WARNINGS
+#include <cstdio>
+#include <cstdlib>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+ENABLE_WARNINGS
+
+#include "util.h"
+
+MappedFile Util::map_file(const char *file_path) {
+    MappedFile file = {};
+
+#ifdef _WIN32
+    HANDLE file_handle = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                     FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        return file;
+    }
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file_handle);
+        return file;
+    }
+
+    HANDLE mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping_handle == NULL) {
+        CloseHandle(file_handle);
+        return file;
+    }
+
+    file.data = (const u8 *)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+    if (file.data == nullptr) {
+        CloseHandle(mapping_handle);
+        CloseHandle(file_handle);
+        return file;
+    }
+
+    file.size = (usize)file_size.QuadPart;
+    file.file_handle = file_handle;
+    file.mapping_handle = mapping_handle;
+#else
+    int fd = open(file_path, O_RDONLY);
+    if (fd == -1) {
+        return file;
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+        close(fd);
+        return file;
+    }
+
+    void *data = mmap(nullptr, (usize)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping stays valid without the descriptor
+    if (data == MAP_FAILED) {
+        return file;
+    }
+
+    file.data = (const u8 *)data;
+    file.size = (usize)file_stat.st_size;
+#endif
+
+    return file;
+}
+
+void Util::unmap_file(MappedFile &file) {
+    if (file.data == nullptr) {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(file.data);
+    CloseHandle((HANDLE)file.mapping_handle);
+    CloseHandle((HANDLE)file.file_handle);
+#else
+    munmap((void *)file.data, file.size);
+#endif
+
+    file = {};
+}
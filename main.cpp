@@ -3,15 +3,47 @@
 #include "common.h"
 
 DISABLE_WARNINGS
+#include <cstdio>
+#include <cstring>
 #include <memory>
 ENABLE_WARNINGS
 
 #include "application.h"
+#include "devtools.h"
 #include "pong.cpp"
 
-int main() {
+int main(int argc, char **argv) {
+    // Offline asset step: pong --encode-adpcm in.wav out.wav
+    if (argc == 4 && strcmp(argv[1], "--encode-adpcm") == 0) {
+        return Sfx::encode_adpcm_wav(argv[2], argv[3]) ? 0 : 1;
+    }
+    if (argc >= 2) {
+        const DevTool *tool = devtool_find(argv[1]);
+        if (tool != nullptr) {
+            return tool->run(argc - 2, argv + 2);
+        }
+    }
+
+    // Where the sound goes: pong --sfx-output voices|mixer|null, or pong --sfx-output wav out.wav
+    SfxSettings sfx_settings;
+    if (argc >= 3 && strcmp(argv[1], "--sfx-output") == 0) {
+        if (strcmp(argv[2], "voices") == 0) {
+            sfx_settings.output = SfxOutput::Voices;
+        } else if (strcmp(argv[2], "mixer") == 0) {
+            sfx_settings.output = SfxOutput::Mixer;
+        } else if (strcmp(argv[2], "null") == 0) {
+            sfx_settings.output = SfxOutput::MixerNull;
+        } else if (strcmp(argv[2], "wav") == 0 && argc >= 4) {
+            sfx_settings.output = SfxOutput::MixerWav;
+            sfx_settings.wav_file_name = argv[3];
+        } else {
+            printf("Unknown sfx output %s. It's voices, mixer, null or wav <file>\n", argv[2]);
+            return 1;
+        }
+    }
+
     std::unique_ptr<IGame> pong = std::make_unique<PongGame>();
-    Application app(std::move(pong));
+    Application app(std::move(pong), sfx_settings);
     app.loop();
     return 0;
 }
@@ -17,32 +17,10 @@ struct PongWorldConfig {
 };
 
 struct PongWorldUpdateResult {
-    bool did_score;
     bool is_gameover;
 };
 
-static bool pad_ball_collision_check(const GoData &pad_go, Vec2 ball_displacement_from,
-                                     Vec2 ball_displacement_to, Vec2 &out_collision_point) {
-    Rect rect_world = pad_go.get_world_rect();
-    Vec2 edges[4] = {
-        rect_world.min,
-        Vec2(rect_world.min.x, rect_world.max.y),
-        rect_world.max,
-        Vec2(rect_world.max.x, rect_world.min.y),
-    };
-
-    for (int i = 0; i < 4; i++) {
-        Vec2 intersection;
-        bool has_intersection = check_line_segment_intersection(ball_displacement_from, ball_displacement_to,
-                                                                edges[i], edges[(i + 1) % 4], intersection);
-        if (has_intersection) {
-            out_collision_point = intersection;
-            return true;
-        }
-    }
-
-    return false;
-}
+#define PONG_WALL_BOX_FIRST 2 // Ball sweep boxes: the two pads, then the two walls
 
 struct PongGame : IGame {
 
@@ -141,20 +119,58 @@ struct PongGame : IGame {
             next_state = "intermission_state";
         }
 
-        // UI draw
-        Widget &swidget = engine.get_widget("score");
-        if (result.did_score) {
-            swidget.data.set_str(world.score);
-            swidget.ru.update(swidget.data);
-        }
+        // Only laid out again when the score changes
+        engine.get_widget("score").data.set_u32(world.score);
 
         return next_state;
     }
 
+    struct PongBounceContext {
+        PongGame *game;
+        Engine *engine;
+        u32 sounded_boxes; // A bit per box that played its sound this tick
+    };
+
+    // Only called for bounces that reflect. is_first_on_box is false for the box's later bounces in the same
+    // tick, e.g. the ball wedged between a pad and a wall, which stay quiet
+    void on_ball_bounce(const CollisionBounce &bounce, Vec2 &velocity, Engine &engine, bool is_first_on_box) {
+        if (bounce.box_index >= PONG_WALL_BOX_FIRST) {
+            if (is_first_on_box) {
+                engine.sfx_play(SfxId::SfxHitWall);
+            }
+            return;
+        }
+
+        // Hit paddles
+        if (is_first_on_box) {
+            engine.sfx_play(SfxId::SfxHitPad);
+        }
+        if (bounce.normal.x == 0.0f) {
+            return; // Top or bottom edge of the pad, it just glances off. Not a point
+        }
+
+        world.ball_move_dir = velocity.normalized();
+
+        // randomness
+#ifndef WORLD_DISABLE_BALL_RANDOMNESS
+        const f32 ball_pad_hit_randomness_coeff = 0.2f;
+        world.ball_move_dir.y += engine.get_rng().range(-1.0f, 1.0f) * ball_pad_hit_randomness_coeff;
+        world.ball_move_dir.normalize();
+#endif
+
+        world.score++;
+        world.game_speed_coeff += config.game_speed_increase_coeff;
+        velocity = world.ball_move_dir * (config.ball_speed * world.game_speed_coeff);
+
+        ParticleSystemType hit_particle_type =
+            bounce.position.x > 0 ? ParticleSystemType::PadRight : ParticleSystemType::PadLeft;
+
+        engine.particle_play("game_state", hit_particle_type, bounce.position);
+    }
+
     PongWorldUpdateResult update_world(f32 dt, Engine &engine) {
 
         PongWorldUpdateResult result;
-        result.did_score = false;
         result.is_gameover = false;
 
         GoData &pad1_go = engine.get_go("pad1").data;
@@ -182,50 +198,36 @@ struct PongGame : IGame {
         // Ball move
         //
 
+        // Walls are boxes just outside the area, so they go through the same sweep as the pads
+        const f32 wall_offset = config.area_extents.y + 0.5f;
+        const Vec2 wall_size = Vec2(config.area_extents.x * 4.0f, 1.0f);
+        const Rect boxes[4] = {
+            pad1_go.get_world_rect(),
+            pad2_go.get_world_rect(),
+            Rect(Vec2(0.0f, wall_offset), wall_size),
+            Rect(Vec2(0.0f, -wall_offset), wall_size),
+        };
+
+        Rect ball_rect = ball_go.get_world_rect();
+        Vec2 ball_half_size = (ball_rect.max - ball_rect.min) * 0.5f;
         Vec2 ball_pos = ball_go.transform.get_pos_xy();
-        Vec2 ball_displacement = world.ball_move_dir * (config.ball_speed * world.game_speed_coeff * dt);
-        Vec2 ball_next_pos = ball_pos + ball_displacement;
-
-        Vec2 collision_point;
-        if (pad_ball_collision_check(pad1_go, ball_pos, ball_next_pos, collision_point) ||
-            pad_ball_collision_check(pad2_go, ball_pos, ball_next_pos, collision_point)) {
-
-            // Hit paddles
-
-            ball_pos = collision_point; // Snap to hit position
-            world.ball_move_dir.x *= -1;
-
-            // randomness
-#ifndef WORLD_DISABLE_BALL_RANDOMNESS
-            const f32 ball_pad_hit_randomness_coeff = 0.2f;
-            world.ball_move_dir.y += rand_range(-1.0f, 1.0f) * ball_pad_hit_randomness_coeff;
-            world.ball_move_dir.normalize();
-#endif
-
-            ball_displacement = world.ball_move_dir * (config.ball_speed * dt);
-            ball_next_pos = ball_pos + ball_displacement;
-
-            world.score++;
-            result.did_score = true;
-            world.game_speed_coeff += config.game_speed_increase_coeff;
-
-            engine.sfx_play(SfxId::SfxHitPad);
-
-            ParticleSystemType hit_particle_type =
-                collision_point.x > 0 ? ParticleSystemType::PadRight : ParticleSystemType::PadLeft;
-
-            engine.particle_play("game_state", hit_particle_type, collision_point);
-        }
-
-        if (ball_next_pos.y > config.area_extents.y || ball_next_pos.y < -config.area_extents.y) {
-            // Reflection from top/bottom
-            world.ball_move_dir.y *= -1;
-
-            ball_displacement = world.ball_move_dir * (config.ball_speed * dt);
-            ball_next_pos = ball_pos + ball_displacement;
-
-            engine.sfx_play(SfxId::SfxHitWall);
-        }
+        Vec2 ball_velocity = world.ball_move_dir * (config.ball_speed * world.game_speed_coeff);
+
+        // Every hit in this tick, in order. A fast ball can hit a pad and a wall in the same frame
+        PongBounceContext bounce_context = {this, &engine, 0};
+        auto on_bounce = [](const CollisionBounce &bounce, Vec2 &velocity, void *context) {
+            PongBounceContext &pong = *(PongBounceContext *)context;
+            const u32 box_bit = 1u << bounce.box_index;
+            const bool is_first_on_box = (pong.sounded_boxes & box_bit) == 0;
+            pong.sounded_boxes |= box_bit;
+            pong.game->on_ball_bounce(bounce, velocity, *pong.engine, is_first_on_box);
+        };
+
+        CollisionBounce bounces[COLLISION_MAX_BOUNCES];
+        sweep_and_bounce(ball_pos, ball_half_size, ball_velocity, dt, boxes, 4, bounces,
+                         COLLISION_MAX_BOUNCES, on_bounce, &bounce_context);
+        world.ball_move_dir = ball_velocity.normalized();
+        Vec2 ball_next_pos = ball_pos;
 
         result.is_gameover =
             ball_next_pos.x > config.area_extents.x || ball_next_pos.x < -config.area_extents.x;
@@ -248,7 +250,7 @@ struct PongGame : IGame {
             engine.get_go("pad1").data.transform.set_pos_xy(Vec2(config.distance_from_center, 0));
             engine.get_go("pad2").data.transform.set_pos_xy(Vec2(-config.distance_from_center, 0));
             engine.get_go("ball").data.transform.set_pos_xy(Vec2::zero());
-            engine.get_widget("score").data.set_str(0);
+            engine.get_widget("score").data.set_u32(0);
 
             world_init();
 
@@ -257,8 +259,6 @@ struct PongGame : IGame {
             next_state = "game_state";
         }
 
-        engine.get_widget("intermission").ru.draw();
-
         return next_state;
     }
 };
\ No newline at end of file